@@ -0,0 +1,285 @@
+/*
+ * Headless benchmark (-bench): composites a dense flock into an offscreen
+ * 1080p buffer and reports the cost of each compositor mode, and of the
+ * indexed compositor with its expansion pass, then compares a sequential
+ * compose-and-present loop with the pipelined one. Last, it times the
+ * toaster collision test with and without the pixel-mask narrow phase.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../img/toast.xpm"
+#include "../img/toaster.xpm"
+#include "compositor.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "simulation.h"
+
+#define TOAST_SPRITE TOASTER_SPRITE_COUNT
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+#define BENCH_TOASTERS 300
+#define BENCH_TOASTS 150
+#define BENCH_FRAMES 300
+#define COLLISION_PAIRS 4096
+#define COLLISION_ROUNDS 256
+
+struct BenchSprite { int x, y, moveDistance, frame; };
+
+static void place_items(struct ComposeItem *items, struct BenchSprite *s, int count,
+                        const struct CompositorSprite *sprites, int frame) {
+    for (int i = 0; i < count; i++) {
+        int span = BENCH_WIDTH + BENCH_HEIGHT + 2 * SPRITE_SIZE;
+        int d = (s[i].moveDistance * frame) % span;
+        int x = s[i].x - d, y = s[i].y + d;
+        /* Wrap along the diagonal so density stays constant. */
+        if (x <= -SPRITE_SIZE) x += span;
+        if (y >= BENCH_HEIGHT) y -= span;
+        const struct CompositorSprite *sp = s[i].frame < 0 ? &sprites[TOAST_SPRITE]
+            : &sprites[(s[i].frame + frame / 4) % TOASTER_SPRITE_COUNT];
+        items[i] = (struct ComposeItem){ sp, x, y };
+    }
+}
+
+static uint64_t time_frame(struct Compositor *c, const struct ComposeItem *items, int count) {
+    uint64_t t0 = metrics_now_ns();
+    compositor_draw(c, items, count);
+    return metrics_now_ns() - t0;
+}
+
+/* Indexed compose, then expansion of the damaged rects into 32-bit pixels. */
+static uint64_t time_indexed_frame(struct Compositor *c, const struct ComposeItem *items, int count,
+                                   const uint32_t *lut, uint32_t *pixels, uint64_t *expandNs) {
+    struct ComposeRect damage[MAX_DAMAGE_RECTS];
+    uint64_t t0 = metrics_now_ns();
+    compositor_draw(c, items, count);
+    uint64_t t1 = metrics_now_ns();
+    int rects = compositor_damage(c, damage, MAX_DAMAGE_RECTS);
+    for (int i = 0; i < rects; i++)
+        compositor_expand(c, lut, &damage[i], pixels + (size_t)damage[i].y * BENCH_WIDTH + damage[i].x,
+                          BENCH_WIDTH, 4);
+    *expandNs += metrics_now_ns() - t1;
+    return t1 - t0;
+}
+
+/* Toaster pairs within a couple of sprite widths, so most bounding boxes
+ * are near each other and many overlap. */
+struct BenchPair { int x1, y1, x2, y2, frame1, frame2; };
+
+static void bench_collisions(struct BenchPair *pairs) {
+    /* Time the masks the simulation itself collides with. */
+    struct Simulation sim;
+    initSimulation(&sim, BENCH_WIDTH, BENCH_HEIGHT, 1, 0, SIM_BASE_HZ, 1);
+    srand(2);
+    for (int i = 0; i < COLLISION_PAIRS; i++) {
+        pairs[i] = (struct BenchPair){ rand() % (2 * SPRITE_SIZE), rand() % (2 * SPRITE_SIZE),
+                                       rand() % (2 * SPRITE_SIZE), rand() % (2 * SPRITE_SIZE),
+                                       rand() % TOASTER_SPRITE_COUNT, rand() % TOASTER_SPRITE_COUNT };
+    }
+    long boxHits = 0, pixelHits = 0;
+    uint64_t t0 = metrics_now_ns();
+    for (int r = 0; r < COLLISION_ROUNDS; r++) {
+        for (int i = 0; i < COLLISION_PAIRS; i++) {
+            const struct BenchPair *p = &pairs[i];
+            boxHits += hasSpriteCollision(p->x1, p->y1, p->x2, p->y2, 0);
+        }
+    }
+    uint64_t t1 = metrics_now_ns();
+    for (int r = 0; r < COLLISION_ROUNDS; r++) {
+        for (int i = 0; i < COLLISION_PAIRS; i++) {
+            const struct BenchPair *p = &pairs[i];
+            pixelHits += hasSpriteCollision(p->x1, p->y1, p->x2, p->y2, 0) &&
+                         hasPixelCollision(sim.toasterMasks[p->frame1], p->x1, p->y1,
+                                           sim.toasterMasks[p->frame2], p->x2, p->y2);
+        }
+    }
+    uint64_t t2 = metrics_now_ns();
+    double tests = (double)COLLISION_PAIRS * COLLISION_ROUNDS;
+    printf(" collisions: %.0f toaster pairs\n", tests);
+    printf("  bounding box:        %6.2f ns/pair, %5.1f%% colliding\n",
+           (t1 - t0) / tests, 100.0 * boxHits / tests);
+    printf("  box + pixel masks:   %6.2f ns/pair, %5.1f%% colliding\n",
+           (t2 - t1) / tests, 100.0 * pixelHits / tests);
+}
+
+/* "Present" stands in for the upload to the display: a copy of the frame. */
+struct BenchPipeline {
+    uint32_t *buffers[PIPELINE_DEPTH];
+    uint32_t *display;
+    size_t frameBytes;
+    struct FrameQueue ready, free;
+};
+
+static void *present_frames(void *arg) {
+    struct BenchPipeline *p = (struct BenchPipeline *)arg;
+    int s;
+    while ((s = frame_queue_pop(&p->ready)) >= 0) {
+        memcpy(p->display, p->buffers[s], p->frameBytes);
+        frame_queue_push(&p->free, s);
+    }
+    return NULL;
+}
+
+/* Wall time for BENCH_FRAMES composed and presented, one after the other or
+ * with presenting frame N overlapping composing frame N+1. */
+static uint64_t time_presented(struct Compositor *c, struct BenchPipeline *p, struct ComposeItem *items,
+                               struct BenchSprite *flock, int count,
+                               const struct CompositorSprite *sprites, int pipelined) {
+    pthread_t thread;
+    if (pipelined) {
+        if (frame_queue_init(&p->ready) != 0) return 0;
+        if (frame_queue_init(&p->free) != 0) {
+            frame_queue_destroy(&p->ready);
+            return 0;
+        }
+        for (int i = 0; i < PIPELINE_DEPTH; i++) frame_queue_push(&p->free, i);
+        if (pthread_create(&thread, NULL, present_frames, p) != 0) {
+            frame_queue_destroy(&p->ready);
+            frame_queue_destroy(&p->free);
+            return 0;
+        }
+    }
+    uint64_t t0 = metrics_now_ns();
+    for (int f = 0; f < BENCH_FRAMES; f++) {
+        place_items(items, flock, count, sprites, f);
+        if (!pipelined) {
+            compositor_draw(c, items, count);
+            memcpy(p->display, c->pixels, p->frameBytes);
+            continue;
+        }
+        int s = frame_queue_pop(&p->free);
+        compositor_set_target(c, p->buffers[s]);
+        compositor_draw(c, items, count);
+        frame_queue_push(&p->ready, s);
+    }
+    if (pipelined) {
+        frame_queue_close(&p->ready);
+        pthread_join(thread, NULL);
+        frame_queue_destroy(&p->ready);
+        frame_queue_destroy(&p->free);
+    }
+    uint64_t elapsed = metrics_now_ns() - t0;
+    compositor_set_target(c, p->buffers[0]);
+    return elapsed;
+}
+
+int run_benchmark(void) {
+    static const struct PixelFormat argb8888 = { 0xff0000, 0xff00, 0xff };
+    enum { COUNT = BENCH_TOASTERS + BENCH_TOASTS };
+    const size_t frameBytes = (size_t)BENCH_WIDTH * BENCH_HEIGHT * sizeof(uint32_t);
+    struct CompositorSprite *sprites = malloc(sizeof(*sprites) * (TOASTER_SPRITE_COUNT + 1));
+    uint32_t *backPixels = malloc(frameBytes);
+    uint32_t *frontPixels = malloc(frameBytes);
+    uint32_t *indexedPixels = malloc(frameBytes);
+    uint8_t *indices = malloc((size_t)BENCH_WIDTH * BENCH_HEIGHT);
+    struct BenchSprite *flock = malloc(sizeof(*flock) * COUNT);
+    struct ComposeItem *items = malloc(sizeof(*items) * COUNT);
+    struct BenchPair *pairs = malloc(sizeof(*pairs) * COLLISION_PAIRS);
+    struct BenchPipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.frameBytes = frameBytes;
+    pipeline.display = malloc(frameBytes);
+    int pipelineOk = pipeline.display != NULL;
+    for (int i = 0; i < PIPELINE_DEPTH; i++)
+        pipelineOk = (pipeline.buffers[i] = malloc(frameBytes)) && pipelineOk;
+    struct Palette palette = { 0 };
+    uint32_t lut[PALETTE_SIZE];
+    struct Compositor back, front, indexed;
+    int ok = sprites && backPixels && frontPixels && indexedPixels && indices && flock && items && pairs && pipelineOk;
+    for (int i = 0; ok && i < TOASTER_SPRITE_COUNT; i++)
+        ok = compositor_load_sprite(&sprites[i], (const char *const *)toasterXpm[i], &argb8888, &palette) == 0;
+    if (ok)
+        ok = compositor_load_sprite(&sprites[TOAST_SPRITE], (const char *const *)toastXpm, &argb8888, &palette) == 0;
+    if (ok)
+        ok = compositor_init(&back, backPixels, BENCH_WIDTH, BENCH_HEIGHT, BENCH_WIDTH,
+                             0, COMPOSE_BACK_TO_FRONT) == 0;
+    if (ok && compositor_init(&front, frontPixels, BENCH_WIDTH, BENCH_HEIGHT, BENCH_WIDTH,
+                              0, COMPOSE_FRONT_TO_BACK) != 0) {
+        compositor_free(&back);
+        ok = 0;
+    }
+    if (ok && compositor_init_indexed(&indexed, indices, BENCH_WIDTH, BENCH_HEIGHT, BENCH_WIDTH,
+                                      0, COMPOSE_FRONT_TO_BACK) != 0) {
+        compositor_free(&back);
+        compositor_free(&front);
+        ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "flying-toasters: benchmark setup failed\n");
+        free(sprites); free(backPixels); free(frontPixels); free(indexedPixels); free(indices);
+        free(flock); free(items); free(pairs);
+        for (int i = 0; i < PIPELINE_DEPTH; i++) free(pipeline.buffers[i]);
+        free(pipeline.display);
+        return 1;
+    }
+    compositor_build_lut(&palette, &argb8888, lut);
+
+    /* The dense flock stresses the compositors; at the saver's own density
+     * little of the frame changes, which is where damage tracking pays off. */
+    static const struct { const char *name; int toasters, toasts; } scenes[] = {
+        { "dense", BENCH_TOASTERS, BENCH_TOASTS },
+        { "saver", 10, 6 },
+    };
+    printf("flying-toasters benchmark: %dx%d, %d frames\n", BENCH_WIDTH, BENCH_HEIGHT, BENCH_FRAMES);
+    int mismatches = 0;
+    for (size_t s = 0; s < sizeof(scenes) / sizeof(scenes[0]); s++) {
+        int count = scenes[s].toasters + scenes[s].toasts;
+
+        /* Toasts first so toasters draw on top, as in the saver. */
+        srand(1);
+        for (int i = 0; i < count; i++) {
+            flock[i].x = rand() % (BENCH_WIDTH + SPRITE_SIZE) - SPRITE_SIZE / 2;
+            flock[i].y = rand() % (BENCH_HEIGHT + SPRITE_SIZE) - SPRITE_SIZE / 2;
+            flock[i].moveDistance = 1 + rand() % 4;
+            flock[i].frame = i < scenes[s].toasts ? -1 : rand() % TOASTER_SPRITE_COUNT;
+        }
+        indexed.fullDamage = 1;
+
+        uint64_t backNs = 0, frontNs = 0, indexedNs = 0, expandNs = 0;
+        int sceneMismatches = 0;
+        for (int f = 0; f < BENCH_FRAMES; f++) {
+            place_items(items, flock, count, sprites, f);
+            backNs += time_frame(&back, items, count);
+            frontNs += time_frame(&front, items, count);
+            indexedNs += time_indexed_frame(&indexed, items, count, lut, indexedPixels, &expandNs);
+            if (memcmp(backPixels, frontPixels, frameBytes) != 0 ||
+                memcmp(frontPixels, indexedPixels, frameBytes) != 0)
+                sceneMismatches++;
+        }
+        mismatches += sceneMismatches;
+
+        printf(" %s: %d toasters, %d toasts\n", scenes[s].name, scenes[s].toasters, scenes[s].toasts);
+        printf("  compose back-to-front: %7.3f ms/frame\n", backNs / 1e6 / BENCH_FRAMES);
+        printf("  compose front-to-back: %7.3f ms/frame (%.2fx)\n", frontNs / 1e6 / BENCH_FRAMES,
+               frontNs ? (double)backNs / frontNs : 0.0);
+        printf("  compose indexed:       %7.3f ms/frame + %.3f ms expanding damage (%.2fx)\n",
+               indexedNs / 1e6 / BENCH_FRAMES, expandNs / 1e6 / BENCH_FRAMES,
+               indexedNs + expandNs ? (double)frontNs / (indexedNs + expandNs) : 0.0);
+        printf("  frames identical: %s\n", sceneMismatches ? "NO" : "yes");
+
+        /* The compositor must draw from a clean slate into the pipeline buffers. */
+        struct Compositor piped;
+        if (compositor_init(&piped, pipeline.buffers[0], BENCH_WIDTH, BENCH_HEIGHT, BENCH_WIDTH,
+                            0, COMPOSE_FRONT_TO_BACK) == 0) {
+            uint64_t seqNs = time_presented(&piped, &pipeline, items, flock, count, sprites, 0);
+            uint64_t pipeNs = time_presented(&piped, &pipeline, items, flock, count, sprites, 1);
+            compositor_free(&piped);
+            if (seqNs && pipeNs) {
+                printf("  compose+present sequential: %7.1f frames/s\n", BENCH_FRAMES * 1e9 / seqNs);
+                printf("  compose+present pipelined:  %7.1f frames/s (%.2fx, %d buffers)\n",
+                       BENCH_FRAMES * 1e9 / pipeNs, (double)seqNs / pipeNs, PIPELINE_DEPTH);
+            }
+        }
+    }
+    bench_collisions(pairs);
+
+    compositor_free(&back);
+    compositor_free(&front);
+    compositor_free(&indexed);
+    free(sprites); free(backPixels); free(frontPixels); free(indexedPixels); free(indices);
+    free(flock); free(items); free(pairs);
+    for (int i = 0; i < PIPELINE_DEPTH; i++) free(pipeline.buffers[i]);
+    free(pipeline.display);
+    return mismatches ? 1 : 0;
+}
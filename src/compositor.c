@@ -0,0 +1,318 @@
+/*
+ * Software sprite compositor shared by the X11 and SDL software paths.
+ * Sprites carry a 64-bit opacity mask per row, so blits copy whole opaque runs
+ * and the front-to-back mode can skip covered pixels with a few word operations.
+ * Indexed compositors move one byte per pixel and expand through a palette
+ * lookup table only for the damaged parts of the frame.
+ */
+#include "compositor.h"
+#include "xpmdecode.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Coverage rows store column c at bit c + 64, so sprites hanging off the left
+ * edge still index a valid word. */
+#define COVERAGE_PAD 64
+
+static int init_buffer(struct Compositor *c, uint8_t *pixels, int bytesPerPixel, int width, int height,
+                       int stride, uint32_t background, enum ComposeMode mode) {
+    c->pixels = pixels;
+    c->bytesPerPixel = bytesPerPixel;
+    c->width = width;
+    c->height = height;
+    c->stride = stride;
+    c->background = background;
+    c->mode = mode;
+    c->coverageStride = (width + COVERAGE_PAD + 63) / 64 + 1;
+    c->coverage = (uint64_t *)calloc((size_t)c->coverageStride * height, sizeof(uint64_t));
+    /* Only indexed frames are expanded by damage; 32-bit ones are used whole. */
+    c->tilesX = bytesPerPixel == 1 ? (width + DAMAGE_TILE - 1) / DAMAGE_TILE : 0;
+    c->tilesY = bytesPerPixel == 1 ? (height + DAMAGE_TILE - 1) / DAMAGE_TILE : 0;
+    c->tiles = bytesPerPixel == 1 ? (uint8_t *)calloc((size_t)c->tilesX * c->tilesY, 1) : NULL;
+    c->fullDamage = 1;
+    if (!c->coverage || (bytesPerPixel == 1 && !c->tiles)) {
+        compositor_free(c);
+        return -1;
+    }
+    return 0;
+}
+
+int compositor_init(struct Compositor *c, uint32_t *pixels, int width, int height, int stride,
+                    uint32_t background, enum ComposeMode mode) {
+    return init_buffer(c, (uint8_t *)pixels, 4, width, height, stride, background, mode);
+}
+
+int compositor_init_indexed(struct Compositor *c, uint8_t *indices, int width, int height, int stride,
+                            uint8_t background, enum ComposeMode mode) {
+    return init_buffer(c, indices, 1, width, height, stride, background, mode);
+}
+
+void compositor_free(struct Compositor *c) {
+    free(c->coverage);
+    free(c->tiles);
+    c->coverage = NULL;
+    c->tiles = NULL;
+}
+
+void compositor_set_target(struct Compositor *c, void *pixels) {
+    c->pixels = (uint8_t *)pixels;
+}
+
+static uint32_t scale_channel(uint8_t v, uint32_t mask) {
+    if (!mask) return 0;
+    int shift = __builtin_ctz(mask);
+    int bits = __builtin_popcount(mask);
+    uint32_t scaled = bits >= 8 ? (uint32_t)v << (bits - 8) : (uint32_t)v >> (8 - bits);
+    return (scaled << shift) & mask;
+}
+
+uint32_t compositor_map_rgb(const struct PixelFormat *fmt, uint8_t r, uint8_t g, uint8_t b) {
+    return scale_channel(r, fmt->rmask) | scale_channel(g, fmt->gmask) | scale_channel(b, fmt->bmask);
+}
+
+/* Palette index of an 0xRRGGBB colour, appending it if new; -1 when full. */
+static int palette_index(struct Palette *palette, uint32_t rgb) {
+    if (palette->count == 0) {
+        palette->rgb[0] = 0;
+        palette->count = 1;
+    }
+    for (int i = 0; i < palette->count; i++) {
+        if (palette->rgb[i] == rgb) return i;
+    }
+    if (palette->count == PALETTE_SIZE) return -1;
+    palette->rgb[palette->count] = rgb;
+    return palette->count++;
+}
+
+int compositor_load_sprite(struct CompositorSprite *sprite, const char *const *xpm_data,
+                           const struct PixelFormat *fmt, struct Palette *palette) {
+    int w, h;
+    uint32_t *argb = xpm_to_argb(xpm_data, &w, &h);
+    if (!argb) return -1;
+    if (w != SPRITE_SIZE || h != SPRITE_SIZE) {
+        free(argb);
+        return -1;
+    }
+    for (int y = 0; y < SPRITE_SIZE; y++) {
+        uint64_t row = 0;
+        for (int x = 0; x < SPRITE_SIZE; x++) {
+            uint32_t px = argb[y * SPRITE_SIZE + x];
+            int index = 0;
+            if (px >> 24) {
+                row |= 1ULL << x;
+                sprite->pixels[y * SPRITE_SIZE + x] =
+                    compositor_map_rgb(fmt, (px >> 16) & 0xff, (px >> 8) & 0xff, px & 0xff);
+                if (palette && (index = palette_index(palette, px & 0xffffff)) < 0) {
+                    free(argb);
+                    return -1;
+                }
+            } else {
+                sprite->pixels[y * SPRITE_SIZE + x] = 0;
+            }
+            sprite->indices[y * SPRITE_SIZE + x] = (uint8_t)index;
+        }
+        sprite->opaque[y] = row;
+    }
+    free(argb);
+    return 0;
+}
+
+/* Limit a sprite row mask to the columns inside [0, width). */
+static uint64_t clip_row(uint64_t bits, int x, int width) {
+    if (x < 0) bits &= ~0ULL << -x;
+    if (width - x < SPRITE_SIZE) bits &= (1ULL << (width - x)) - 1;
+    return bits;
+}
+
+/* Length of the run of set bits starting at bit `start`. */
+static int run_length(uint64_t bits, int start) {
+    uint64_t rest = ~(bits >> start);
+    return rest ? __builtin_ctzll(rest) : SPRITE_SIZE - start;
+}
+
+/* Pixel data of sprite row sy in the compositor's format. */
+static const uint8_t *sprite_row(const struct Compositor *c, const struct CompositorSprite *sprite, int sy) {
+    if (c->bytesPerPixel == 1) return sprite->indices + sy * SPRITE_SIZE;
+    return (const uint8_t *)(sprite->pixels + sy * SPRITE_SIZE);
+}
+
+static uint8_t *frame_row(const struct Compositor *c, int y) {
+    return c->pixels + (size_t)y * c->stride * c->bytesPerPixel;
+}
+
+static void copy_runs(uint8_t *row, int x, const uint8_t *src, uint64_t bits, int bpp) {
+    while (bits) {
+        int start = __builtin_ctzll(bits);
+        int len = run_length(bits, start);
+        memcpy(row + (size_t)(x + start) * bpp, src + (size_t)start * bpp, (size_t)len * bpp);
+        if (start + len >= 64) break;
+        bits &= ~0ULL << (start + len);
+    }
+}
+
+/* First column in [from, limit) whose coverage bit equals `covered`, or limit. */
+static int next_coverage(const uint64_t *cov, int from, int limit, int covered) {
+    while (from < limit) {
+        uint64_t word = cov[from >> 6];
+        if (!covered) word = ~word;
+        word >>= from & 63;
+        if (word) {
+            from += __builtin_ctzll(word);
+            return from < limit ? from : limit;
+        }
+        from = (from | 63) + 1;
+    }
+    return limit;
+}
+
+static void fill_span(uint8_t *row, int x0, int x1, uint32_t value, int bpp) {
+    if (bpp == 1 || value == 0) {
+        memset(row + (size_t)x0 * bpp, (int)value, (size_t)(x1 - x0) * bpp);
+    } else {
+        uint32_t *px = (uint32_t *)row;
+        for (int x = x0; x < x1; x++) px[x] = value;
+    }
+}
+
+static int item_visible(const struct Compositor *c, const struct ComposeItem *it) {
+    return it->x > -SPRITE_SIZE && it->x < c->width && it->y > -SPRITE_SIZE && it->y < c->height;
+}
+
+/* Age the damage tiles and mark those under this frame's sprites. */
+static void mark_damage(struct Compositor *c, const struct ComposeItem *items, int count) {
+    size_t tileCount = (size_t)c->tilesX * c->tilesY;
+    for (size_t t = 0; t < tileCount; t++) c->tiles[t] = (uint8_t)((c->tiles[t] & 1) << 1);
+    for (int i = 0; i < count; i++) {
+        const struct ComposeItem *it = &items[i];
+        if (!item_visible(c, it)) continue;
+        int tx0 = (it->x < 0 ? 0 : it->x) / DAMAGE_TILE;
+        int ty0 = (it->y < 0 ? 0 : it->y) / DAMAGE_TILE;
+        int tx1 = (it->x + SPRITE_SIZE > c->width ? c->width - 1 : it->x + SPRITE_SIZE - 1) / DAMAGE_TILE;
+        int ty1 = (it->y + SPRITE_SIZE > c->height ? c->height - 1 : it->y + SPRITE_SIZE - 1) / DAMAGE_TILE;
+        for (int ty = ty0; ty <= ty1; ty++) {
+            for (int tx = tx0; tx <= tx1; tx++) c->tiles[(size_t)ty * c->tilesX + tx] |= 1;
+        }
+    }
+}
+
+static void draw_back_to_front(struct Compositor *c, const struct ComposeItem *items, int count) {
+    int bpp = c->bytesPerPixel;
+    for (int y = 0; y < c->height; y++) {
+        fill_span(frame_row(c, y), 0, c->width, c->background, bpp);
+    }
+    for (int i = 0; i < count; i++) {
+        const struct ComposeItem *it = &items[i];
+        if (!item_visible(c, it)) continue;
+        int sy0 = it->y < 0 ? -it->y : 0;
+        int sy1 = c->height - it->y < SPRITE_SIZE ? c->height - it->y : SPRITE_SIZE;
+        for (int sy = sy0; sy < sy1; sy++) {
+            uint64_t bits = clip_row(it->sprite->opaque[sy], it->x, c->width);
+            copy_runs(frame_row(c, it->y + sy), it->x, sprite_row(c, it->sprite, sy), bits, bpp);
+        }
+    }
+}
+
+static void draw_front_to_back(struct Compositor *c, const struct ComposeItem *items, int count) {
+    int bpp = c->bytesPerPixel;
+    memset(c->coverage, 0, (size_t)c->coverageStride * c->height * sizeof(uint64_t));
+
+    for (int i = count - 1; i >= 0; i--) {
+        const struct ComposeItem *it = &items[i];
+        if (!item_visible(c, it)) continue;
+        int pos = it->x + COVERAGE_PAD;
+        int w = pos >> 6, sh = pos & 63;
+        int sy0 = it->y < 0 ? -it->y : 0;
+        int sy1 = c->height - it->y < SPRITE_SIZE ? c->height - it->y : SPRITE_SIZE;
+        for (int sy = sy0; sy < sy1; sy++) {
+            uint64_t bits = clip_row(it->sprite->opaque[sy], it->x, c->width);
+            uint64_t *cov = c->coverage + (size_t)(it->y + sy) * c->coverageStride;
+            uint64_t covered = sh ? (cov[w] >> sh) | (cov[w + 1] << (64 - sh)) : cov[w];
+            uint64_t need = bits & ~covered;
+            if (!need) continue;
+            copy_runs(frame_row(c, it->y + sy), it->x, sprite_row(c, it->sprite, sy), need, bpp);
+            cov[w] |= need << sh;
+            if (sh) cov[w + 1] |= need >> (64 - sh);
+        }
+    }
+
+    /* Background only where no sprite landed: every pixel is written once. */
+    for (int y = 0; y < c->height; y++) {
+        uint8_t *row = frame_row(c, y);
+        const uint64_t *cov = c->coverage + (size_t)y * c->coverageStride + COVERAGE_PAD / 64;
+        int x = next_coverage(cov, 0, c->width, 0);
+        while (x < c->width) {
+            int end = next_coverage(cov, x, c->width, 1);
+            fill_span(row, x, end, c->background, bpp);
+            x = next_coverage(cov, end, c->width, 0);
+        }
+    }
+}
+
+void compositor_draw(struct Compositor *c, const struct ComposeItem *items, int count) {
+    if (c->tiles) mark_damage(c, items, count);
+    if (c->mode == COMPOSE_FRONT_TO_BACK)
+        draw_front_to_back(c, items, count);
+    else
+        draw_back_to_front(c, items, count);
+}
+
+int compositor_damage(struct Compositor *c, struct ComposeRect *rects, int max) {
+    int n = 0;
+    if (!c->tiles) c->fullDamage = 1;
+    for (int ty = 0; ty < c->tilesY && !c->fullDamage; ty++) {
+        const uint8_t *tiles = c->tiles + (size_t)ty * c->tilesX;
+        int tx = 0;
+        while (tx < c->tilesX) {
+            if (!tiles[tx]) {
+                tx++;
+                continue;
+            }
+            int start = tx;
+            while (tx < c->tilesX && tiles[tx]) tx++;
+            if (n == max) {
+                c->fullDamage = 1;
+                break;
+            }
+            int x = start * DAMAGE_TILE, y = ty * DAMAGE_TILE;
+            int x1 = tx * DAMAGE_TILE < c->width ? tx * DAMAGE_TILE : c->width;
+            int y1 = y + DAMAGE_TILE < c->height ? y + DAMAGE_TILE : c->height;
+            rects[n++] = (struct ComposeRect){ x, y, x1 - x, y1 - y };
+        }
+    }
+    if (c->fullDamage) {
+        c->fullDamage = 0;
+        if (max < 1) return 0;
+        rects[0] = (struct ComposeRect){ 0, 0, c->width, c->height };
+        return 1;
+    }
+    return n;
+}
+
+void compositor_build_lut(const struct Palette *palette, const struct PixelFormat *fmt, uint32_t *lut) {
+    for (int i = 0; i < PALETTE_SIZE; i++) {
+        uint32_t rgb = i < palette->count ? palette->rgb[i] : 0;
+        lut[i] = compositor_map_rgb(fmt, (rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff);
+    }
+}
+
+/* Plain loops over the index bytes: the compiler unrolls them, and vectorises
+ * with gathers where the target has them. */
+static void expand_row32(uint32_t *restrict dst, const uint8_t *restrict src, int n, const uint32_t *restrict lut) {
+    for (int x = 0; x < n; x++) dst[x] = lut[src[x]];
+}
+
+static void expand_row16(uint16_t *restrict dst, const uint8_t *restrict src, int n, const uint32_t *restrict lut) {
+    for (int x = 0; x < n; x++) dst[x] = (uint16_t)lut[src[x]];
+}
+
+void compositor_expand(const struct Compositor *c, const uint32_t *lut, const struct ComposeRect *r,
+                       void *dst, int dstStride, int dstBytesPerPixel) {
+    for (int y = 0; y < r->h; y++) {
+        const uint8_t *src = c->pixels + (size_t)(r->y + y) * c->stride + r->x;
+        uint8_t *row = (uint8_t *)dst + (size_t)y * dstStride * dstBytesPerPixel;
+        if (dstBytesPerPixel == 4)
+            expand_row32((uint32_t *)row, src, r->w, lut);
+        else
+            expand_row16((uint16_t *)row, src, r->w, lut);
+    }
+}
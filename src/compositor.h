@@ -0,0 +1,104 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <stdint.h>
+
+#define SPRITE_SIZE 64
+#define PALETTE_SIZE 256
+#define DAMAGE_TILE 64      /* damage is tracked in DAMAGE_TILE square tiles */
+#define MAX_DAMAGE_RECTS 64 /* rect budget for compositor_damage() callers */
+
+/* Channel masks of the target pixel format (e.g. an X visual or SDL texture). */
+struct PixelFormat {
+    uint32_t rmask, gmask, bmask;
+};
+
+/* Colours shared by all sprites of an indexed compositor, as 0xRRGGBB.
+ * Entry 0 is black and doubles as the background. */
+struct Palette {
+    int count;
+    uint32_t rgb[PALETTE_SIZE];
+};
+
+/* Sprite converted to the target pixel format, and to palette indices when
+ * loaded with a palette. Bit x of opaque[y] is set when pixel (x, y) is drawn;
+ * one 64-bit word per row because SPRITE_SIZE is 64. */
+struct CompositorSprite {
+    uint32_t pixels[SPRITE_SIZE * SPRITE_SIZE];
+    uint8_t indices[SPRITE_SIZE * SPRITE_SIZE];
+    uint64_t opaque[SPRITE_SIZE];
+};
+
+struct ComposeItem {
+    const struct CompositorSprite *sprite;
+    int x;
+    int y;
+};
+
+struct ComposeRect {
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+enum ComposeMode {
+    COMPOSE_BACK_TO_FRONT,  /* clear, then draw items in order */
+    COMPOSE_FRONT_TO_BACK   /* draw items in reverse, skipping covered pixels */
+};
+
+/* Software compositor into a caller-owned buffer of 32-bit pixels, or of 8-bit
+ * palette indices for an indexed compositor. */
+struct Compositor {
+    uint8_t *pixels;
+    int bytesPerPixel;      /* 4, or 1 when indexed */
+    int width;
+    int height;
+    int stride;             /* in pixels */
+    uint32_t background;    /* pixel value, or palette index when indexed */
+    enum ComposeMode mode;
+    uint64_t *coverage;     /* one bit per pixel, used by COMPOSE_FRONT_TO_BACK */
+    int coverageStride;     /* in words */
+    uint8_t *tiles;         /* per damage tile: bit 0 drawn this frame, bit 1 last frame; indexed only */
+    int tilesX;
+    int tilesY;
+    int fullDamage;         /* nothing presented yet: the whole frame is damaged */
+};
+
+int compositor_init(struct Compositor *c, uint32_t *pixels, int width, int height, int stride,
+                    uint32_t background, enum ComposeMode mode);
+int compositor_init_indexed(struct Compositor *c, uint8_t *indices, int width, int height, int stride,
+                            uint8_t background, enum ComposeMode mode);
+void compositor_free(struct Compositor *c);
+/* Draw the following frames into another buffer of the same size and format,
+ * e.g. the next buffer of a pipeline. Damage still refers to the previous frame. */
+void compositor_set_target(struct Compositor *c, void *pixels);
+
+uint32_t compositor_map_rgb(const struct PixelFormat *fmt, uint8_t r, uint8_t g, uint8_t b);
+
+/* Load an XPM sprite; returns 0 on success, -1 on error. With a palette, new
+ * colours are appended to it and the sprite's indices are filled in too. */
+int compositor_load_sprite(struct CompositorSprite *sprite, const char *const *xpm_data,
+                           const struct PixelFormat *fmt, struct Palette *palette);
+
+/* Compose one frame. Items are listed back to front (later items on top);
+ * both modes produce identical pixels. */
+void compositor_draw(struct Compositor *c, const struct ComposeItem *items, int count);
+
+/* Regions that changed since the previous frame, as row-merged tile runs.
+ * Returns the number of rects, or a single full-frame rect on the first frame
+ * or when there would be more than max. Outside these rects the frame is
+ * identical to the previous one. Only indexed compositors track damage; a
+ * 32-bit one always reports the full frame. */
+int compositor_damage(struct Compositor *c, struct ComposeRect *rects, int max);
+
+/* Build a lookup table from palette index to pixel value in fmt. */
+void compositor_build_lut(const struct Palette *palette, const struct PixelFormat *fmt, uint32_t *lut);
+
+/* Expand a rect of an indexed frame through lut into dst, which points at the
+ * rect's top-left pixel and has dstStride pixels per row and 2 or 4 bytes per
+ * pixel, e.g. a locked texture region. */
+void compositor_expand(const struct Compositor *c, const uint32_t *lut, const struct ComposeRect *r,
+                       void *dst, int dstStride, int dstBytesPerPixel);
+
+#endif
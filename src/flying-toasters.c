@@ -7,37 +7,101 @@
 #include "../img/toast.xpm"
 #include "../img/toaster.xpm"
 #include "xpm.h"
+#include "metrics.h"
+#include "framesink.h"
 #include "flying-toasters.h"
 
 #ifdef HAVE_XSCREENSAVER_X11
-int run_xscreensaver_x11(void);
+#include "xscreensaver-x11.h"
 #endif
 
-#define TOASTER_SPRITE_COUNT 6
+int run_benchmark(void);
+int run_verify(int update);
+
+/* Apply one event to the loop state: quit requests and window visibility. */
+static void handleEvent(const SDL_Event *event, int *running, int *visible) {
+    if (event->type == SDL_QUIT ||
+        (event->type == SDL_KEYDOWN && event->key.keysym.sym == SDLK_ESCAPE)) {
+        *running = 0;
+    } else if (event->type == SDL_WINDOWEVENT) {
+        switch (event->window.event) {
+        case SDL_WINDOWEVENT_HIDDEN:
+        case SDL_WINDOWEVENT_MINIMIZED:
+            *visible = 0;
+            break;
+        case SDL_WINDOWEVENT_SHOWN:
+        case SDL_WINDOWEVENT_RESTORED:
+        case SDL_WINDOWEVENT_EXPOSED:
+            *visible = 1;
+            break;
+        }
+    }
+}
+
 #define TOASTER_COUNT 10
 #define TOAST_COUNT 6
-#define SPRITE_SIZE 64
-#define GRID_WIDTH 4
-#define GRID_HEIGHT 4
-#define MAX_TOASTER_SPEED 4
-#define MAX_TOAST_SPEED 3
-#define FPS 60
+#define FPS 60          /* render rate when the display's refresh rate is unknown */
+#define SIM_HZ 60       /* default simulation tick rate, see -tick */
+#define SINK_WIDTH 1920 /* default -framesink frame size, see -size */
+#define SINK_HEIGHT 1080
+#define TOAST_SPRITE TOASTER_SPRITE_COUNT
 
 int main(int argc, char *argv[]) {
-    srand((unsigned)time(NULL));
+    uint32_t seed = (uint32_t)time(NULL);
+
+    int windowed = 0;
+    int composite = 0;
+    int indexed = 0;
+    int tickHz = SIM_HZ;
+    const char *metricsPath = getenv(METRICS_SOCKET_ENV);
+    const char *sinkPath = NULL;
+    int sinkWidth = SINK_WIDTH, sinkHeight = SINK_HEIGHT;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-windowed") == 0) {
+            windowed = 1;
+        } else if (strcmp(argv[i], "-composite") == 0) {
+            composite = 1;
+        } else if (strcmp(argv[i], "-indexed") == 0) {
+            composite = 1;
+            indexed = 1;
+        } else if (strcmp(argv[i], "-tick") == 0 && i + 1 < argc) {
+            tickHz = atoi(argv[++i]);
+            if (tickHz < 1 || tickHz > 1000) tickHz = SIM_HZ;
+        } else if (strcmp(argv[i], "-bench") == 0) {
+            return run_benchmark();
+        } else if (strcmp(argv[i], "-verify") == 0) {
+            return run_verify(i + 1 < argc && strcmp(argv[i + 1], "-update") == 0);
+        } else if (strcmp(argv[i], "-metrics") == 0 && i + 1 < argc) {
+            metricsPath = argv[++i];
+        } else if (strcmp(argv[i], "-framesink") == 0 && i + 1 < argc) {
+            sinkPath = argv[++i];
+        } else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &sinkWidth, &sinkHeight) != 2 ||
+                sinkWidth < 1 || sinkHeight < 1 || sinkWidth > 16384 || sinkHeight > 16384) {
+                sinkWidth = SINK_WIDTH;
+                sinkHeight = SINK_HEIGHT;
+            }
+        }
+    }
+    if (metricsPath && *metricsPath && metrics_start(metricsPath) == 0) {
+        atexit(metrics_stop);
+    }
+
+    /* Headless output into shared memory for another process to display. */
+    if (sinkPath) {
+        return run_framesink(sinkPath, sinkWidth, sinkHeight, tickHz, seed);
+    }
 
     /* When run by xscreensaver, use raw X11 to draw on its window. */
     if (getenv("XSCREENSAVER_WINDOW") != NULL && getenv("XSCREENSAVER_WINDOW")[0] != '\0') {
 #ifdef HAVE_XSCREENSAVER_X11
-        return run_xscreensaver_x11();
+        return run_xscreensaver_x11(tickHz, seed);
 #else
-        fprintf(stderr, "flying-toasters: xscreensaver requires libx11-dev and libxpm-dev\n");
+        fprintf(stderr, "flying-toasters: xscreensaver requires libx11-dev, libxpm-dev and libxext-dev\n");
         return 1;
 #endif
     }
 
-    int windowed = (argc > 1 && strcmp(argv[1], "-windowed") == 0);
-
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
         return 1;
@@ -98,81 +162,123 @@ int main(int argc, char *argv[]) {
     int width, height;
     SDL_GetWindowSize(window, &width, &height);
 
+    struct SoftwareFrame frame;
+    struct SoftwareFrame *soft = NULL;
+    if (composite) {
+        if (initSoftwareFrame(&frame, renderer, width, height, indexed) == 0) {
+            soft = &frame;
+        } else {
+            fprintf(stderr, "flying-toasters: software compositing unavailable, using textures\n");
+        }
+    }
+    struct ComposeItem items[TOAST_COUNT + TOASTER_COUNT];
+
 #ifdef __linux__
     SDL_Delay(200);  /* Let compositor finish window setup */
 #endif
 
-    struct Toaster toasters[TOASTER_COUNT];
-    struct Toast toasts[TOAST_COUNT];
-    int *grid = initGrid();
+    /* Render at the display's refresh rate; motion speed comes from the fixed
+     * simulation tick, so faster panels get smoother rather than faster motion. */
+    int renderHz = FPS;
+    SDL_DisplayMode mode;
+    if (SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0) {
+        renderHz = mode.refresh_rate;
+    }
+    uint64_t frameBudget = 1000000000u / (unsigned)renderHz;
 
-    spawnToasters(toasters, width, height, grid);
-    spawnToasts(toasts, width, height, grid);
+    struct Simulation sim;
+    initSimulation(&sim, width, height, TOASTER_COUNT, TOAST_COUNT, tickHz, seed);
 
-    int frameCounter = 0;
     int running = 1;
+    int visible = !(SDL_GetWindowFlags(window) & (SDL_WINDOW_HIDDEN | SDL_WINDOW_MINIMIZED));
     SDL_Event event;
+    uint64_t lastFrameStart = 0;
 
     while (running) {
         while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT ||
-                (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE))
-                running = 0;
+            handleEvent(&event, &running, &visible);
+        }
+        if (running && !visible) {
+            /* Nothing on screen: block in the event queue instead of rendering.
+             * The simulation is frozen meanwhile, as nobody can tell. */
+            while (running && !visible && SDL_WaitEvent(&event)) {
+                handleEvent(&event, &running, &visible);
+            }
+            lastFrameStart = 0;
+            if (soft) soft->redraw = 1;
+            continue;
         }
 
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderClear(renderer);
+        uint64_t frameStart = metrics_now_ns();
+        int visibleToasters = 0, visibleToasts = 0;
+        int itemCount = 0;
 
-        frameCounter = (frameCounter + 1) % 256;
+        advanceSimulation(&sim, lastFrameStart ? frameStart - lastFrameStart : sim.tickNs);
+        int alpha = simulationAlpha(&sim);
 
-        /* Draw and update toasts */
+        if (!soft) {
+            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+            SDL_RenderClear(renderer);
+        }
+
+        /* Toasts first so toasters fly over them */
         for (int i = 0; i < TOAST_COUNT; i++) {
-            if (isScrolledToScreen(toasts[i].x, toasts[i].y, width)) {
-                drawSprite(renderer, toastTexture, toasts[i].x, toasts[i].y);
-            }
-            int newX = toasts[i].x - toasts[i].moveDistance;
-            int newY = toasts[i].y + toasts[i].moveDistance;
-            if (isScrolledOutOfScreen(newX, newY, height)) {
-                setToastSpawnCoordinates(&toasts[i], width, height);
-            } else {
-                toasts[i].x = newX;
-                toasts[i].y = newY;
+            int x, y;
+            toastDrawPosition(&sim, i, alpha, &x, &y);
+            if (isScrolledToScreen(x, y, width)) {
+                if (soft) {
+                    items[itemCount++] = (struct ComposeItem){ &soft->sprites[TOAST_SPRITE], x, y };
+                } else {
+                    drawSprite(renderer, toastTexture, x, y);
+                }
+                visibleToasts++;
             }
         }
-
-        /* Draw and update toasters */
         for (int i = 0; i < TOASTER_COUNT; i++) {
-            if (isScrolledToScreen(toasters[i].x, toasters[i].y, width)) {
-                drawSprite(renderer, toasterTextures[toasters[i].currentFrame],
-                          toasters[i].x, toasters[i].y);
-            }
-            int newX = toasters[i].x - toasters[i].moveDistance;
-            int newY = toasters[i].y + toasters[i].moveDistance;
-            if (isScrolledOutOfScreen(newX, newY, height)) {
-                setToasterSpawnCoordinates(&toasters[i], width, height);
-            } else {
-                for (int j = 0; j < TOASTER_COUNT; j++) {
-                    if (i != j && hasSpriteCollision(toasters[j].x, toasters[j].y, newX, newY, 0)) {
-                        if (toasters[i].x <= toasters[j].x + SPRITE_SIZE) {
-                            newY = toasters[i].y + toasters[j].moveDistance;
-                        } else {
-                            newX = toasters[i].x - toasters[j].moveDistance;
-                        }
-                        break;
-                    }
+            int x, y;
+            int sprite = sim.toasters[i].currentFrame;
+            toasterDrawPosition(&sim, i, alpha, &x, &y);
+            if (isScrolledToScreen(x, y, width)) {
+                if (soft) {
+                    items[itemCount++] = (struct ComposeItem){ &soft->sprites[sprite], x, y };
+                } else {
+                    drawSprite(renderer, toasterTextures[sprite], x, y);
                 }
-                toasters[i].x = newX;
-                toasters[i].y = newY;
-            }
-            if (frameCounter % (10 - toasters[i].moveDistance) == 0) {
-                toasters[i].currentFrame = (toasters[i].currentFrame + 1) % TOASTER_SPRITE_COUNT;
+                visibleToasters++;
             }
         }
 
-        SDL_RenderPresent(renderer);
-        SDL_Delay(1000 / FPS);
+        if (soft) {
+            submitSoftwareFrame(soft, items, itemCount);
+        }
+        uint64_t composeEnd = metrics_now_ns();
+        /* Uploads the previous frame while the worker composes this one. */
+        int ready = soft ? waitSoftwareFrame(soft) : -1;
+        uint64_t presentStart = metrics_now_ns();
+        if (ready >= 0) {
+            uploadSoftwareFrame(soft, ready);
+            SDL_RenderCopy(renderer, soft->texture, NULL, NULL);
+        }
+        if (!soft || ready >= 0) SDL_RenderPresent(renderer);
+        uint64_t presentEnd = metrics_now_ns();
+        if (lastFrameStart) {
+            /* Compositing happens on the worker, which reports its own time;
+             * waiting for it counts as neither compose nor present. */
+            uint64_t composeNs = composeEnd - frameStart;
+            if (soft) composeNs += __atomic_load_n(&soft->lastComposeNs, __ATOMIC_RELAXED);
+            metrics_record_frame(frameStart - lastFrameStart, frameBudget,
+                                 composeNs, presentEnd - presentStart,
+                                 visibleToasters, visibleToasts);
+        }
+        lastFrameStart = frameStart;
+
+        uint64_t spent = metrics_now_ns() - frameStart;
+        if (spent < frameBudget) {
+            SDL_Delay((Uint32)((frameBudget - spent) / 1000000u));
+        }
     }
 
+    if (soft) freeSoftwareFrame(soft);
     freeSprites(toasterTextures, toastTexture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -181,19 +287,6 @@ int main(int argc, char *argv[]) {
     return 0;
 }
 
-int hasSpriteCollision(int x1, int y1, int x2, int y2, int gap) {
-    return (x1 < x2 + SPRITE_SIZE + gap) && (x2 < x1 + SPRITE_SIZE + gap) &&
-           (y1 < y2 + SPRITE_SIZE + gap) && (y2 < y1 + SPRITE_SIZE + gap);
-}
-
-int isScrolledToScreen(int x, int y, int screenWidth) {
-    return (y + SPRITE_SIZE > 0) && (x + SPRITE_SIZE > 0) && (x < screenWidth);
-}
-
-int isScrolledOutOfScreen(int x, int y, int screenHeight) {
-    return (x <= -SPRITE_SIZE) || (y >= screenHeight);
-}
-
 void loadSprites(SDL_Renderer *renderer,
                  SDL_Texture **toasterTextures,
                  SDL_Texture **toastTexture) {
@@ -224,35 +317,124 @@ void freeSprites(SDL_Texture **toasterTextures, SDL_Texture *toastTexture) {
     SDL_DestroyTexture(toastTexture);
 }
 
-void setToasterSpawnCoordinates(struct Toaster *toaster, int screenWidth, int screenHeight) {
-    int slotWidth = screenWidth / GRID_WIDTH;
-    int slotHeight = screenHeight / GRID_HEIGHT;
-    toaster->x = screenHeight + (toaster->slot % GRID_WIDTH) * slotWidth + (slotWidth - SPRITE_SIZE) / 2;
-    toaster->y = -screenHeight + (toaster->slot / GRID_WIDTH) * slotHeight + (slotHeight - SPRITE_SIZE) / 2;
+static void *composeFrames(void *arg) {
+    struct SoftwareFrame *frame = (struct SoftwareFrame *)arg;
+    struct Compositor *c = &frame->compositor;
+    int s;
+    while ((s = frame_queue_pop(&frame->jobs)) >= 0) {
+        struct SoftwareSlot *slot = &frame->slots[s];
+        uint64_t start = metrics_now_ns();
+        compositor_set_target(c, slot->buffer);
+        if (slot->redraw) c->fullDamage = 1;
+        compositor_draw(c, slot->items, slot->count);
+        if (frame->indexed) {
+            slot->rects = compositor_damage(c, slot->damage, MAX_DAMAGE_RECTS);
+            slot->view = *c;
+        }
+        __atomic_store_n(&frame->lastComposeNs, metrics_now_ns() - start, __ATOMIC_RELAXED);
+        frame_queue_push(&frame->done, s);
+    }
+    return NULL;
 }
 
-void setToastSpawnCoordinates(struct Toast *toast, int screenWidth, int screenHeight) {
-    int slotWidth = screenWidth / GRID_WIDTH;
-    int slotHeight = screenHeight / GRID_HEIGHT;
-    toast->x = screenHeight + (toast->slot % GRID_WIDTH) * slotWidth + (slotWidth - SPRITE_SIZE) / 2;
-    toast->y = -screenHeight + (toast->slot / GRID_WIDTH) * slotHeight + (slotHeight - SPRITE_SIZE) / 2;
+static void freeSoftwareBuffers(struct SoftwareFrame *frame) {
+    if (frame->texture) SDL_DestroyTexture(frame->texture);
+    free(frame->sprites);
+    for (int i = 0; i < PIPELINE_DEPTH; i++) free(frame->slots[i].buffer);
 }
 
-void spawnToasters(struct Toaster *toasters, int screenWidth, int screenHeight, int *grid) {
-    for (int i = 0; i < TOASTER_COUNT; i++) {
-        toasters[i].slot = grid[i];
-        toasters[i].moveDistance = 1 + rand() % MAX_TOASTER_SPEED;
-        toasters[i].currentFrame = rand() % TOASTER_SPRITE_COUNT;
-        setToasterSpawnCoordinates(&toasters[i], screenWidth, screenHeight);
+int initSoftwareFrame(struct SoftwareFrame *frame, SDL_Renderer *renderer, int width, int height, int indexed) {
+    static const struct PixelFormat argb8888 = { 0xff0000, 0xff00, 0xff };
+    struct Palette palette = { 0 };
+    struct Palette *pal = indexed ? &palette : NULL;
+    size_t bufferSize = (size_t)width * height * (indexed ? 1 : sizeof(uint32_t));
+    memset(frame, 0, sizeof(*frame));
+    frame->indexed = indexed;
+    frame->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                       SDL_TEXTUREACCESS_STREAMING, width, height);
+    frame->sprites = (struct CompositorSprite *)malloc(
+        sizeof(struct CompositorSprite) * (TOASTER_SPRITE_COUNT + 1));
+    int ok = frame->texture && frame->sprites;
+    for (int i = 0; ok && i < PIPELINE_DEPTH; i++) {
+        ok = (frame->slots[i].buffer = malloc(bufferSize)) != NULL;
+    }
+    for (int i = 0; ok && i < TOASTER_SPRITE_COUNT; i++) {
+        ok = compositor_load_sprite(&frame->sprites[i],
+                                    (const char *const *)toasterXpm[i], &argb8888, pal) == 0;
+    }
+    if (ok) {
+        ok = compositor_load_sprite(&frame->sprites[TOAST_SPRITE],
+                                    (const char *const *)toastXpm, &argb8888, pal) == 0;
+    }
+    if (ok && indexed) {
+        compositor_build_lut(&palette, &argb8888, frame->lut);
+        ok = compositor_init_indexed(&frame->compositor, frame->slots[0].buffer, width, height, width,
+                                     0, COMPOSE_FRONT_TO_BACK) == 0;
+    } else if (ok) {
+        ok = compositor_init(&frame->compositor, frame->slots[0].buffer, width, height, width,
+                             0, COMPOSE_FRONT_TO_BACK) == 0;
+    }
+    if (!ok) {
+        freeSoftwareBuffers(frame);
+        return -1;
+    }
+    if (frame_queue_init(&frame->jobs) != 0 || frame_queue_init(&frame->done) != 0 ||
+        pthread_create(&frame->thread, NULL, composeFrames, frame) != 0) {
+        compositor_free(&frame->compositor);
+        freeSoftwareBuffers(frame);
+        return -1;
     }
+    return 0;
+}
+
+void submitSoftwareFrame(struct SoftwareFrame *frame, const struct ComposeItem *items, int count) {
+    /* uploadSoftwareFrame() keeps at most two frames in flight, so this slot is free. */
+    int s = (int)(frame->submitted++ % PIPELINE_DEPTH);
+    struct SoftwareSlot *slot = &frame->slots[s];
+    memcpy(slot->items, items, sizeof(*items) * (size_t)count);
+    slot->count = count;
+    slot->redraw = frame->redraw;
+    frame->redraw = 0;
+    frame_queue_push(&frame->jobs, s);
 }
 
-void spawnToasts(struct Toast *toasts, int screenWidth, int screenHeight, int *grid) {
-    for (int i = 0; i < TOAST_COUNT; i++) {
-        toasts[i].slot = grid[TOASTER_COUNT + i];
-        toasts[i].moveDistance = 1 + rand() % MAX_TOAST_SPEED;
-        setToastSpawnCoordinates(&toasts[i], screenWidth, screenHeight);
+int waitSoftwareFrame(struct SoftwareFrame *frame) {
+    if (frame->submitted - frame->presented < 2) return -1;
+    frame->presented++;
+    return frame_queue_pop(&frame->done);
+}
+
+void uploadSoftwareFrame(struct SoftwareFrame *frame, int s) {
+    struct SoftwareSlot *slot = &frame->slots[s];
+    const struct Compositor *c = &frame->compositor;
+    if (!frame->indexed) {
+        SDL_UpdateTexture(frame->texture, NULL, slot->buffer, c->width * (int)sizeof(uint32_t));
+        return;
     }
+    /* The texture keeps the last upload, so only changed rects are expanded,
+     * each directly into its locked region. */
+    for (int i = 0; i < slot->rects; i++) {
+        const struct ComposeRect *r = &slot->damage[i];
+        SDL_Rect rect = { r->x, r->y, r->w, r->h };
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(frame->texture, &rect, &pixels, &pitch) != 0) {
+            /* This rect stays stale; the next frame submitted repaints everything. */
+            frame->redraw = 1;
+            continue;
+        }
+        compositor_expand(&slot->view, frame->lut, r, pixels, pitch / (int)sizeof(uint32_t), 4);
+        SDL_UnlockTexture(frame->texture);
+    }
+}
+
+void freeSoftwareFrame(struct SoftwareFrame *frame) {
+    frame_queue_close(&frame->jobs);
+    pthread_join(frame->thread, NULL);
+    frame_queue_destroy(&frame->jobs);
+    frame_queue_destroy(&frame->done);
+    compositor_free(&frame->compositor);
+    freeSoftwareBuffers(frame);
 }
 
 void drawSprite(SDL_Renderer *renderer, SDL_Texture *texture, int x, int y) {
@@ -261,16 +443,3 @@ void drawSprite(SDL_Renderer *renderer, SDL_Texture *texture, int x, int y) {
     SDL_RenderCopy(renderer, texture, NULL, &dst);
 }
 
-int *initGrid(void) {
-    static int grid[TOASTER_COUNT + TOAST_COUNT];
-    for (int i = 0; i < TOASTER_COUNT + TOAST_COUNT; i++) {
-        grid[i] = i;
-    }
-    for (int i = 0; i < TOASTER_COUNT + TOAST_COUNT - 1; i++) {
-        int j = i + rand() % (TOASTER_COUNT + TOAST_COUNT - i);
-        int t = grid[j];
-        grid[j] = grid[i];
-        grid[i] = t;
-    }
-    return grid;
-}
@@ -2,38 +2,56 @@
 #define FLYING_TOASTERS_H
 
 #include <SDL.h>
-
-struct Toaster {
-    int slot;
-    int x;
-    int y;
-    int moveDistance;
-    int currentFrame;
-};
-
-struct Toast {
-    int slot;
-    int x;
-    int y;
-    int moveDistance;
-};
-
-int hasSpriteCollision(int x1, int y1, int x2, int y2, int gap);
-int isScrolledToScreen(int x, int y, int screenWidth);
-int isScrolledOutOfScreen(int x, int y, int screenHeight);
+#include "compositor.h"
+#include "pipeline.h"
+#include "simulation.h"
 
 void loadSprites(SDL_Renderer *renderer,
                  SDL_Texture **toasterTextures,
                  SDL_Texture **toastTexture);
 void freeSprites(SDL_Texture **toasterTextures, SDL_Texture *toastTexture);
 
-void setToasterSpawnCoordinates(struct Toaster *toaster, int screenWidth, int screenHeight);
-void setToastSpawnCoordinates(struct Toast *toast, int screenWidth, int screenHeight);
-void spawnToasters(struct Toaster *toasters, int screenWidth, int screenHeight, int *grid);
-void spawnToasts(struct Toast *toasts, int screenWidth, int screenHeight, int *grid);
-
 void drawSprite(SDL_Renderer *renderer, SDL_Texture *texture, int x, int y);
 
-int *initGrid(void);
+/* Software compositing into a streaming texture (-composite): frames are built
+ * front to back by the shared compositor on a worker thread, so composing one
+ * frame overlaps uploading and presenting the previous one. With -indexed the
+ * frame is built as palette indices and only damaged rects are expanded,
+ * straight into the locked texture. */
+struct SoftwareSlot {
+    void *buffer;                       /* composed pixels, or indices when indexed */
+    struct ComposeItem items[2 * MAX_ENTITIES];
+    int count;
+    int redraw;                         /* damage the whole frame */
+    struct Compositor view;             /* compositor state for this frame, for expansion */
+    struct ComposeRect damage[MAX_DAMAGE_RECTS];
+    int rects;
+};
+
+struct SoftwareFrame {
+    SDL_Texture *texture;
+    int indexed;
+    uint32_t lut[PALETTE_SIZE];
+    struct Compositor compositor;       /* used by the compose thread only */
+    struct CompositorSprite *sprites;   /* toaster frames, then the toast */
+    struct SoftwareSlot slots[PIPELINE_DEPTH];
+    struct FrameQueue jobs;             /* slots to compose */
+    struct FrameQueue done;             /* composed slots to upload */
+    unsigned submitted;
+    unsigned presented;
+    int redraw;
+    uint64_t lastComposeNs;             /* compose time of the latest frame, set by the compose thread */
+    pthread_t thread;
+};
+
+int initSoftwareFrame(struct SoftwareFrame *frame, SDL_Renderer *renderer, int width, int height, int indexed);
+/* Queue a frame for the compose thread. Items are copied. */
+void submitSoftwareFrame(struct SoftwareFrame *frame, const struct ComposeItem *items, int count);
+/* Wait for the oldest composed frame, once a newer frame is in flight behind
+ * it; returns its slot, or -1 if there is nothing to upload yet. */
+int waitSoftwareFrame(struct SoftwareFrame *frame);
+/* Upload a slot returned by waitSoftwareFrame() to the texture. */
+void uploadSoftwareFrame(struct SoftwareFrame *frame, int slot);
+void freeSoftwareFrame(struct SoftwareFrame *frame);
 
 #endif
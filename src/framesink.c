@@ -0,0 +1,304 @@
+/*
+ * Shared-memory frame sink (-framesink): composites into a ring of memfd
+ * buffers that local consumers map read-only, so frames leave the process
+ * without a copy. See framesink.h for the protocol.
+ */
+#define _GNU_SOURCE
+#include "framesink.h"
+#include <stdio.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../img/toast.xpm"
+#include "../img/toaster.xpm"
+#include "compositor.h"
+#include "metrics.h"
+#include "simulation.h"
+#include "sockpath.h"
+
+#define TOASTER_COUNT 10
+#define TOAST_COUNT 6
+#define FPS 60
+#define MAX_CONSUMERS 8
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010   /* Linux 5.1; older headers lack it */
+#endif
+#define PAGE_ALIGN(n) (((n) + 4095u) & ~(uint64_t)4095u)
+
+/* Sprite table for the compositor: toaster frames followed by the toast. */
+#define TOAST_SPRITE TOASTER_SPRITE_COUNT
+
+struct Consumer {
+    int socket;
+    int event;      /* eventfd signalled per frame */
+};
+
+static volatile sig_atomic_t stopRequested;
+
+static void request_stop(int sig) {
+    (void)sig;
+    stopRequested = 1;
+}
+
+static int open_listener(const char *path) {
+    struct sockaddr_un addr;
+    if (!path || !*path || strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "flying-toasters: invalid frame sink socket path\n");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (claim_socket_path(path) != 0) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("flying-toasters: frame sink socket");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, MAX_CONSUMERS) < 0) {
+        perror("flying-toasters: frame sink bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Hand the memfd and the consumer's eventfd over in one message. */
+static int send_fds(int sock, int memfd, int eventFd) {
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    int fds[2] = { memfd, eventFd };
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+static void accept_consumers(int listenFd, int memfd, struct Consumer *consumers, int *count) {
+    int fd;
+    while ((fd = accept(listenFd, NULL, NULL)) >= 0) {
+        int eventFd = *count < MAX_CONSUMERS ? eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK) : -1;
+        if (eventFd < 0 || send_fds(fd, memfd, eventFd) < 0) {
+            if (eventFd >= 0) close(eventFd);
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        consumers[(*count)++] = (struct Consumer){ fd, eventFd };
+    }
+}
+
+/* Consumers never write, so a readable socket means it hung up. */
+static void drop_departed_consumers(struct Consumer *consumers, int *count) {
+    for (int i = 0; i < *count; ) {
+        struct pollfd p = { consumers[i].socket, POLLIN, 0 };
+        char buf[64];
+        if (poll(&p, 1, 0) > 0 && recv(consumers[i].socket, buf, sizeof(buf), 0) <= 0) {
+            close(consumers[i].socket);
+            close(consumers[i].event);
+            consumers[i] = consumers[--*count];
+        } else {
+            i++;
+        }
+    }
+}
+
+static void notify_consumers(const struct Consumer *consumers, int count) {
+    const uint64_t one = 1;
+    for (int i = 0; i < count; i++) {
+        ssize_t w = write(consumers[i].event, &one, sizeof(one));
+        (void)w;   /* only fails if the counter would overflow */
+    }
+}
+
+int run_framesink(const char *socketPath, int width, int height, int tickHz, uint32_t seed) {
+    static const struct PixelFormat xrgb8888 = { 0xff0000, 0xff00, 0xff };
+    const uint32_t stride = (uint32_t)width * 4;
+    const uint64_t slotOffset = PAGE_ALIGN(sizeof(struct FrameSinkHeader));
+    const uint64_t slotSize = PAGE_ALIGN((uint64_t)stride * height);
+    const uint64_t size = slotOffset + FRAMESINK_SLOTS * slotSize;
+
+    int memfd = memfd_create("flying-toasters-frames", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0 || ftruncate(memfd, (off_t)size) < 0) {
+        perror("flying-toasters: frame sink memfd");
+        if (memfd >= 0) close(memfd);
+        return 1;
+    }
+    uint8_t *base = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (base == MAP_FAILED) {
+        perror("flying-toasters: frame sink mmap");
+        close(memfd);
+        return 1;
+    }
+    /* Consumers may rely on the size never changing under their mapping.
+     * The future-write seal keeps our mapping writable but stops anyone
+     * mapping the memfd writable again, even by reopening it through /proc;
+     * kernels before 5.1 only get the size seals. */
+    if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0)
+        fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+    /* Consumers get a read-only descriptor, so they can only map it PROT_READ. */
+    char procPath[32];
+    snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", memfd);
+    int readFd = open(procPath, O_RDONLY | O_CLOEXEC);
+    if (readFd < 0) {
+        perror("flying-toasters: frame sink read-only memfd");
+        munmap(base, size);
+        close(memfd);
+        return 1;
+    }
+
+    struct FrameSinkHeader *hdr = (struct FrameSinkHeader *)base;
+    hdr->magic = FRAMESINK_MAGIC;
+    hdr->version = FRAMESINK_VERSION;
+    hdr->width = (uint32_t)width;
+    hdr->height = (uint32_t)height;
+    hdr->stride = stride;
+    hdr->format = FRAMESINK_FORMAT_XRGB8888;
+    hdr->slotCount = FRAMESINK_SLOTS;
+    hdr->slotOffset = (uint32_t)slotOffset;
+    hdr->slotSize = slotSize;
+
+    /* One compositor, retargeted at each slot in turn; it repaints every
+     * pixel, so nothing a slot held before matters. */
+    struct Compositor compositor;
+    struct CompositorSprite *sprites = (struct CompositorSprite *)malloc(
+        sizeof(*sprites) * (TOASTER_SPRITE_COUNT + 1));
+    int ok = sprites != NULL;
+    for (int i = 0; ok && i <= TOASTER_SPRITE_COUNT; i++) {
+        const char *const *xpm = i == TOAST_SPRITE ? (const char *const *)toastXpm
+                                                   : (const char *const *)toasterXpm[i];
+        ok = compositor_load_sprite(&sprites[i], xpm, &xrgb8888, NULL) == 0;
+    }
+    int ready = ok && compositor_init(&compositor, (uint32_t *)(base + slotOffset), width, height,
+                                      width, 0, COMPOSE_FRONT_TO_BACK) == 0;
+    ok = ready;
+    int listenFd = ok ? open_listener(socketPath) : -1;
+    if (listenFd < 0) {
+        if (!ok) fprintf(stderr, "flying-toasters: frame sink setup failed\n");
+        if (ready) compositor_free(&compositor);
+        free(sprites);
+        munmap(base, size);
+        close(readFd);
+        close(memfd);
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    struct Simulation sim;
+    initSimulation(&sim, width, height, TOASTER_COUNT, TOAST_COUNT, tickHz, seed);
+    const uint64_t frameBudget = 1000000000u / FPS;
+    struct Consumer consumers[MAX_CONSUMERS];
+    int consumerCount = 0;
+    struct ComposeItem items[TOAST_COUNT + TOASTER_COUNT];
+
+    uint64_t lastFrameStart = 0;
+    for (uint64_t seq = 1; !stopRequested; seq++) {
+        accept_consumers(listenFd, readFd, consumers, &consumerCount);
+        drop_departed_consumers(consumers, &consumerCount);
+        if (consumerCount == 0) {
+            /* Nobody watching: sleep until someone connects. */
+            struct pollfd p = { listenFd, POLLIN, 0 };
+            poll(&p, 1, -1);
+            lastFrameStart = 0;
+            seq--;
+            continue;
+        }
+
+        uint64_t frameStart = metrics_now_ns();
+        advanceSimulation(&sim, lastFrameStart ? frameStart - lastFrameStart : sim.tickNs);
+        int alpha = simulationAlpha(&sim);
+
+        int n = 0, visibleToasts = 0;
+        for (int i = 0; i < TOAST_COUNT; i++) {
+            int x, y;
+            toastDrawPosition(&sim, i, alpha, &x, &y);
+            if (isScrolledToScreen(x, y, width))
+                items[n++] = (struct ComposeItem){ &sprites[TOAST_SPRITE], x, y };
+        }
+        visibleToasts = n;
+        for (int i = 0; i < TOASTER_COUNT; i++) {
+            int x, y;
+            toasterDrawPosition(&sim, i, alpha, &x, &y);
+            if (isScrolledToScreen(x, y, width))
+                items[n++] = (struct ComposeItem){ &sprites[sim.toasters[i].currentFrame], x, y };
+        }
+
+        /* Seqlock-style publish: mark the slot busy, fill it, then stamp it. */
+        int s = (int)(seq % FRAMESINK_SLOTS);
+        __atomic_store_n(&hdr->slots[s].sequence, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        compositor_set_target(&compositor, base + slotOffset + s * slotSize);
+        compositor_draw(&compositor, items, n);
+        hdr->slots[s].timestampNs = frameStart;
+        __atomic_store_n(&hdr->slots[s].sequence, seq, __ATOMIC_RELEASE);
+        __atomic_store_n(&hdr->latestSequence, seq, __ATOMIC_RELEASE);
+        uint64_t composeEnd = metrics_now_ns();
+        notify_consumers(consumers, consumerCount);
+        uint64_t presentEnd = metrics_now_ns();
+
+        if (lastFrameStart) {
+            metrics_record_frame(frameStart - lastFrameStart, frameBudget,
+                composeEnd - frameStart, presentEnd - composeEnd, n - visibleToasts, visibleToasts);
+        }
+        lastFrameStart = frameStart;
+
+        uint64_t spent = metrics_now_ns() - frameStart;
+        if (spent < frameBudget) {
+            struct timespec ts = { 0, (long)(frameBudget - spent) };
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    for (int i = 0; i < consumerCount; i++) {
+        close(consumers[i].socket);
+        close(consumers[i].event);
+    }
+    close(listenFd);
+    unlink(socketPath);
+    compositor_free(&compositor);
+    free(sprites);
+    munmap(base, size);
+    close(readFd);
+    close(memfd);
+    return 0;
+}
+
+#else
+
+int run_framesink(const char *socketPath, int width, int height, int tickHz, uint32_t seed) {
+    (void)socketPath; (void)width; (void)height; (void)tickHz; (void)seed;
+    fprintf(stderr, "flying-toasters: -framesink needs Linux (memfd and eventfd)\n");
+    return 1;
+}
+
+#endif
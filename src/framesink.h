@@ -0,0 +1,51 @@
+#ifndef FRAMESINK_H
+#define FRAMESINK_H
+
+#include <stdint.h>
+
+/*
+ * Shared-memory frame sink (-framesink PATH): frames are composited straight
+ * into a ring of buffers in one memfd. A consumer connects to the Unix socket
+ * at PATH and receives, as SCM_RIGHTS ancillary data on a one-byte message,
+ * a read-only descriptor of the memfd followed by an eventfd. The memfd is
+ * sealed against resizing and, on Linux 5.1 and later, against new writable
+ * mappings. The eventfd is signalled after every published frame.
+ *
+ * The memfd starts with struct FrameSinkHeader. Frame n lives in slot
+ * n % slotCount at slotOffset + slot * slotSize. To read the latest frame:
+ *   seq = latestSequence (acquire); s = &slots[seq % slotCount];
+ *   check s->sequence == seq (acquire), use the pixels,
+ *   then check s->sequence == seq again; if it changed, the frame was
+ *   overwritten while in use and should be discarded.
+ * A slot's sequence is 0 while the writer is filling it.
+ */
+
+#define FRAMESINK_MAGIC 0x53465446u     /* "FTFS" */
+#define FRAMESINK_VERSION 1
+#define FRAMESINK_SLOTS 3
+#define FRAMESINK_FORMAT_XRGB8888 1     /* native-endian uint32 0x00RRGGBB */
+
+struct FrameSinkSlot {
+    uint64_t sequence;      /* frame number, from 1; 0 while being written */
+    uint64_t timestampNs;   /* CLOCK_MONOTONIC when composed */
+};
+
+struct FrameSinkHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;        /* bytes per row */
+    uint32_t format;
+    uint32_t slotCount;
+    uint32_t slotOffset;    /* bytes from the start of the memfd to slot 0 */
+    uint64_t slotSize;      /* bytes per slot */
+    uint64_t latestSequence;
+    struct FrameSinkSlot slots[FRAMESINK_SLOTS];
+};
+
+/* Render width x height frames into the sink until interrupted.
+ * Returns nonzero if the sink cannot be set up. */
+int run_framesink(const char *socketPath, int width, int height, int tickHz, uint32_t seed);
+
+#endif
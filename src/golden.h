@@ -0,0 +1,40 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include <stdint.h>
+
+/* Reference run for -verify. After an intentional visual or motion change,
+ * regenerate the tables with `flying-toasters -verify -update`. */
+#define GOLDEN_WIDTH 640
+#define GOLDEN_HEIGHT 480
+#define GOLDEN_SEED 0x70a57u
+#define GOLDEN_FRAMES 600
+#define GOLDEN_INTERVAL 60
+#define GOLDEN_CHECKPOINTS (GOLDEN_FRAMES / GOLDEN_INTERVAL)
+
+static const uint64_t goldenFrameHashes[GOLDEN_CHECKPOINTS] = {
+    0x20d76e96020f3a8cULL,
+    0x93cd627bb52d5fa3ULL,
+    0x29fc36f76017cbf7ULL,
+    0x8f53228ebaccfd3fULL,
+    0xdf011a887ee24e0aULL,
+    0xb69e45f8f745ec58ULL,
+    0x0a2e079a25597b48ULL,
+    0x8fb6bb565f1ca545ULL,
+    0xbef66bb132edf308ULL,
+    0xfe053a5b073b5b09ULL,
+};
+static const uint64_t goldenPositionHashes[GOLDEN_CHECKPOINTS] = {
+    0x595f05220c92a15dULL,
+    0xd3cacda1b60eb224ULL,
+    0x03c948aca0206b45ULL,
+    0x4ed93c5a2c677393ULL,
+    0x2f3c35c6ec617729ULL,
+    0x683e26fa6208addeULL,
+    0xf63eee5f31729ed5ULL,
+    0xbac679ef4d5b5006ULL,
+    0x3435ef2ae8f496dfULL,
+    0xabb5e700c566d721ULL,
+};
+
+#endif
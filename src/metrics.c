@@ -0,0 +1,271 @@
+/*
+ * Optional Prometheus metrics on a Unix domain socket.
+ * The render loop publishes counters with relaxed atomics; a listener thread
+ * formats them on demand, so a slow or stuck client never stalls a frame.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "metrics.h"
+#include "sockpath.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Frame period histogram upper bounds in nanoseconds; the last bucket is +Inf. */
+static const uint64_t frame_bucket_ns[] = {
+    8333333, 16666667, 20000000, 25000000, 33333333, 50000000, 100000000
+};
+#define FRAME_BUCKETS (sizeof(frame_bucket_ns) / sizeof(frame_bucket_ns[0]))
+
+struct Stats {
+    uint64_t frames;
+    uint64_t dropped;
+    uint64_t frame_ns_sum;
+    uint64_t compose_ns_sum;
+    uint64_t present_ns_sum;
+    uint64_t last_compose_ns;
+    uint64_t last_present_ns;
+    uint64_t buckets[FRAME_BUCKETS + 1];
+    int toasters;
+    int toasts;
+};
+
+static struct Stats stats;
+static int enabled;
+static int listen_fd = -1;
+static int stop_pipe[2] = { -1, -1 };
+static pthread_t thread;
+static char sock_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+#define LOAD(v) __atomic_load_n(&(v), __ATOMIC_RELAXED)
+#define STORE(v, x) __atomic_store_n(&(v), (x), __ATOMIC_RELAXED)
+#define ADD(v, x) __atomic_fetch_add(&(v), (x), __ATOMIC_RELAXED)
+
+uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void metrics_record_frame(uint64_t frame_ns, uint64_t budget_ns,
+                          uint64_t compose_ns, uint64_t present_ns,
+                          int toasters, int toasts) {
+    if (!LOAD(enabled)) return;
+    size_t b = 0;
+    while (b < FRAME_BUCKETS && frame_ns > frame_bucket_ns[b]) b++;
+    ADD(stats.buckets[b], 1);
+    ADD(stats.frames, 1);
+    /* A period of 1.5 budgets or more means at least one display slot was missed. */
+    if (frame_ns * 2 >= budget_ns * 3) ADD(stats.dropped, 1);
+    ADD(stats.frame_ns_sum, frame_ns);
+    ADD(stats.compose_ns_sum, compose_ns);
+    ADD(stats.present_ns_sum, present_ns);
+    STORE(stats.last_compose_ns, compose_ns);
+    STORE(stats.last_present_ns, present_ns);
+    STORE(stats.toasters, toasters);
+    STORE(stats.toasts, toasts);
+}
+
+static long resident_bytes(void) {
+    long pages = -1, resident = -1;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return -1;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = -1;
+    fclose(f);
+    return resident < 0 ? -1 : resident * sysconf(_SC_PAGESIZE);
+}
+
+static double seconds(uint64_t ns) {
+    return (double)ns / 1e9;
+}
+
+static int format_metrics(char *out, size_t size) {
+    struct rusage ru;
+    double cpu = 0;
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+        cpu = (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+              (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+
+    size_t n = 0;
+#define EMIT(...) do { \
+        int r = snprintf(out + n, size - n, __VA_ARGS__); \
+        if (r < 0 || (size_t)r >= size - n) return -1; \
+        n += (size_t)r; \
+    } while (0)
+
+    EMIT("# HELP flying_toasters_frames_total Frames rendered.\n"
+         "# TYPE flying_toasters_frames_total counter\n"
+         "flying_toasters_frames_total %llu\n", (unsigned long long)LOAD(stats.frames));
+    EMIT("# HELP flying_toasters_frames_dropped_total Frames whose period missed a display slot.\n"
+         "# TYPE flying_toasters_frames_dropped_total counter\n"
+         "flying_toasters_frames_dropped_total %llu\n", (unsigned long long)LOAD(stats.dropped));
+
+    EMIT("# HELP flying_toasters_frame_seconds Time between frame starts.\n"
+         "# TYPE flying_toasters_frame_seconds histogram\n");
+    uint64_t cumulative = 0;
+    for (size_t b = 0; b <= FRAME_BUCKETS; b++) {
+        cumulative += LOAD(stats.buckets[b]);
+        if (b < FRAME_BUCKETS)
+            EMIT("flying_toasters_frame_seconds_bucket{le=\"%g\"} %llu\n",
+                 seconds(frame_bucket_ns[b]), (unsigned long long)cumulative);
+        else
+            EMIT("flying_toasters_frame_seconds_bucket{le=\"+Inf\"} %llu\n",
+                 (unsigned long long)cumulative);
+    }
+    EMIT("flying_toasters_frame_seconds_sum %.6f\n"
+         "flying_toasters_frame_seconds_count %llu\n",
+         seconds(LOAD(stats.frame_ns_sum)), (unsigned long long)cumulative);
+
+    EMIT("# HELP flying_toasters_compose_seconds_total Time spent simulating and compositing.\n"
+         "# TYPE flying_toasters_compose_seconds_total counter\n"
+         "flying_toasters_compose_seconds_total %.6f\n", seconds(LOAD(stats.compose_ns_sum)));
+    EMIT("# HELP flying_toasters_present_seconds_total Time spent presenting frames.\n"
+         "# TYPE flying_toasters_present_seconds_total counter\n"
+         "flying_toasters_present_seconds_total %.6f\n", seconds(LOAD(stats.present_ns_sum)));
+    EMIT("# HELP flying_toasters_last_compose_seconds Compose time of the latest frame.\n"
+         "# TYPE flying_toasters_last_compose_seconds gauge\n"
+         "flying_toasters_last_compose_seconds %.6f\n", seconds(LOAD(stats.last_compose_ns)));
+    EMIT("# HELP flying_toasters_last_present_seconds Present time of the latest frame.\n"
+         "# TYPE flying_toasters_last_present_seconds gauge\n"
+         "flying_toasters_last_present_seconds %.6f\n", seconds(LOAD(stats.last_present_ns)));
+
+    EMIT("# HELP flying_toasters_entities Active sprites by kind.\n"
+         "# TYPE flying_toasters_entities gauge\n"
+         "flying_toasters_entities{kind=\"toaster\"} %d\n"
+         "flying_toasters_entities{kind=\"toast\"} %d\n",
+         LOAD(stats.toasters), LOAD(stats.toasts));
+
+    EMIT("# HELP process_cpu_seconds_total User and system CPU time.\n"
+         "# TYPE process_cpu_seconds_total counter\n"
+         "process_cpu_seconds_total %.6f\n", cpu);
+    long rss = resident_bytes();
+    if (rss >= 0)
+        EMIT("# HELP process_resident_memory_bytes Resident set size.\n"
+             "# TYPE process_resident_memory_bytes gauge\n"
+             "process_resident_memory_bytes %ld\n", rss);
+#undef EMIT
+    return (int)n;
+}
+
+static void send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        struct pollfd p = { fd, POLLOUT, 0 };
+        if (poll(&p, 1, 1000) <= 0) return;
+        ssize_t w = send(fd, buf, len, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EAGAIN || errno == EINTR) continue;
+            return;
+        }
+        buf += w;
+        len -= (size_t)w;
+    }
+}
+
+static void serve_client(int fd) {
+    /* Drain whatever request the client sends (curl sends HTTP, socat nothing). */
+    char req[512];
+    struct pollfd p = { fd, POLLIN, 0 };
+    if (poll(&p, 1, 100) > 0) {
+        ssize_t r = recv(fd, req, sizeof(req), 0);
+        (void)r;
+    }
+
+    char body[4096];
+    int len = format_metrics(body, sizeof(body));
+    if (len < 0) return;
+    char head[128];
+    int hlen = snprintf(head, sizeof(head),
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %d\r\n\r\n", len);
+    send_all(fd, head, (size_t)hlen);
+    send_all(fd, body, (size_t)len);
+}
+
+static void *listener(void *arg) {
+    (void)arg;
+    struct pollfd fds[2] = {
+        { listen_fd, POLLIN, 0 },
+        { stop_pipe[0], POLLIN, 0 },
+    };
+    while (1) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) break;
+        if (!(fds[0].revents & POLLIN)) continue;
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        serve_client(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int metrics_start(const char *socket_path) {
+    struct sockaddr_un addr;
+    if (!socket_path || !*socket_path || strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "flying-toasters: invalid metrics socket path\n");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    if (claim_socket_path(socket_path) != 0) return -1;
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("flying-toasters: metrics socket");
+        return -1;
+    }
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 4) < 0) {
+        perror("flying-toasters: metrics bind");
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+    strcpy(sock_path, socket_path);
+
+    if (pipe(stop_pipe) < 0 || pthread_create(&thread, NULL, listener, NULL) != 0) {
+        fprintf(stderr, "flying-toasters: cannot start metrics thread\n");
+        if (stop_pipe[0] >= 0) { close(stop_pipe[0]); close(stop_pipe[1]); }
+        stop_pipe[0] = stop_pipe[1] = -1;
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(sock_path);
+        return -1;
+    }
+    STORE(enabled, 1);
+    return 0;
+}
+
+void metrics_stop(void) {
+    if (!LOAD(enabled)) return;
+    STORE(enabled, 0);
+    ssize_t w = write(stop_pipe[1], "x", 1);
+    (void)w;
+    pthread_join(thread, NULL);
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    stop_pipe[0] = stop_pipe[1] = -1;
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(sock_path);
+}
@@ -0,0 +1,26 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+/* Environment variable naming the Unix socket to serve metrics on. */
+#define METRICS_SOCKET_ENV "FLYING_TOASTERS_METRICS_SOCKET"
+
+/* Start the metrics listener thread on a Unix domain socket.
+ * Each connection gets one Prometheus text-format snapshot and is closed.
+ * Returns 0 on success, -1 on error (the saver keeps running without metrics). */
+int metrics_start(const char *socket_path);
+void metrics_stop(void);
+
+/* Monotonic clock in nanoseconds, for timing frame phases. */
+uint64_t metrics_now_ns(void);
+
+/* Publish one rendered frame. Called from the render loop only; it does
+ * relaxed atomic adds and never blocks. A no-op when metrics are not started.
+ *   frame_ns   - time since the previous frame started (the frame period)
+ *   budget_ns  - target frame period; longer frames count as dropped */
+void metrics_record_frame(uint64_t frame_ns, uint64_t budget_ns,
+                          uint64_t compose_ns, uint64_t present_ns,
+                          int toasters, int toasts);
+
+#endif
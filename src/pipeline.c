@@ -0,0 +1,72 @@
+/*
+ * Lock-free hand-over of frame buffers between the compose and present threads.
+ */
+#include "pipeline.h"
+
+#define QUEUE_SIZE (PIPELINE_DEPTH + 1)
+
+int frame_queue_init(struct FrameQueue *q) {
+    q->head = 0;
+    q->tail = 0;
+    q->sleeping = 0;
+    q->closed = 0;
+    if (pthread_mutex_init(&q->lock, NULL) != 0) return -1;
+    if (pthread_cond_init(&q->wake, NULL) != 0) {
+        pthread_mutex_destroy(&q->lock);
+        return -1;
+    }
+    return 0;
+}
+
+void frame_queue_destroy(struct FrameQueue *q) {
+    pthread_cond_destroy(&q->wake);
+    pthread_mutex_destroy(&q->lock);
+}
+
+/* Wake a sleeping consumer. Taking the lock orders this against the
+ * consumer's last check, so the wake-up cannot be lost. */
+static void wake_consumer(struct FrameQueue *q) {
+    if (!__atomic_load_n(&q->sleeping, __ATOMIC_SEQ_CST)) return;
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_signal(&q->wake);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void frame_queue_push(struct FrameQueue *q, int slot) {
+    unsigned tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    q->slots[tail % QUEUE_SIZE] = slot;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_SEQ_CST);
+    wake_consumer(q);
+}
+
+static int try_pop(struct FrameQueue *q, int *slot) {
+    unsigned head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(&q->tail, __ATOMIC_SEQ_CST)) return 0;
+    *slot = q->slots[head % QUEUE_SIZE];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int frame_queue_pop(struct FrameQueue *q) {
+    int slot;
+    if (try_pop(q, &slot)) return slot;
+    pthread_mutex_lock(&q->lock);
+    __atomic_store_n(&q->sleeping, 1, __ATOMIC_SEQ_CST);
+    while (!try_pop(q, &slot)) {
+        if (__atomic_load_n(&q->closed, __ATOMIC_SEQ_CST)) {
+            slot = -1;
+            break;
+        }
+        pthread_cond_wait(&q->wake, &q->lock);
+    }
+    __atomic_store_n(&q->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&q->lock);
+    return slot;
+}
+
+void frame_queue_close(struct FrameQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    __atomic_store_n(&q->closed, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&q->wake);
+    pthread_mutex_unlock(&q->lock);
+}
@@ -0,0 +1,32 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+
+/* Frame buffers in flight between the compose and present stages. Two lets
+ * composing frame N+1 overlap presenting frame N; three also absorbs jitter. */
+#define PIPELINE_DEPTH 3
+
+/* Single-producer single-consumer queue of buffer indices. Push and pop are
+ * lock-free; the mutex and condition variable are only touched when the
+ * consumer has to sleep on an empty queue. */
+struct FrameQueue {
+    int slots[PIPELINE_DEPTH + 1];
+    unsigned head;          /* next pop, written by the consumer */
+    unsigned tail;          /* next push, written by the producer */
+    int sleeping;           /* consumer is (about to be) waiting */
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+int frame_queue_init(struct FrameQueue *q);
+void frame_queue_destroy(struct FrameQueue *q);
+/* Never blocks: the queue holds every buffer index at once. */
+void frame_queue_push(struct FrameQueue *q, int slot);
+/* Next index, blocking while empty; -1 once the queue is closed and drained. */
+int frame_queue_pop(struct FrameQueue *q);
+/* Wake the consumer and make further pops on an empty queue return -1. */
+void frame_queue_close(struct FrameQueue *q);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Toaster and toast motion, shared by the SDL and X11 renderers.
+ * The simulation ticks at a fixed rate; renderers interpolate between ticks.
+ */
+#include <stdlib.h>
+#include "../img/toaster.xpm"
+#include "simulation.h"
+#include "xpmdecode.h"
+
+#define MAX_TOASTER_SPEED 4
+#define MAX_TOAST_SPEED 3
+#define MAX_CATCH_UP_TICKS 15   /* drop time beyond this after a stall */
+
+/* xorshift32: identical sequence on every libc, unlike rand(). */
+static int nextRandom(struct Simulation *sim, int range) {
+    uint32_t x = sim->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sim->rng = x;
+    return (int)(x % (uint32_t)range);
+}
+
+static int toPixels(int v) {
+    return v >> FP_SHIFT;   /* arithmetic shift floors negative positions */
+}
+
+int hasSpriteCollision(int x1, int y1, int x2, int y2, int gap) {
+    return (x1 < x2 + SPRITE_SIZE + gap) && (x2 < x1 + SPRITE_SIZE + gap) &&
+           (y1 < y2 + SPRITE_SIZE + gap) && (y2 < y1 + SPRITE_SIZE + gap);
+}
+
+int hasPixelCollision(const uint64_t *mask1, int x1, int y1, const uint64_t *mask2, int x2, int y2) {
+    int dx = x2 - x1, dy = y2 - y1;
+    if (dx <= -SPRITE_SIZE || dx >= SPRITE_SIZE || dy <= -SPRITE_SIZE || dy >= SPRITE_SIZE) return 0;
+    /* Walk the overlapping rows in sprite 1's coordinates, shifting sprite 2's rows into place. */
+    int y0 = dy > 0 ? dy : 0;
+    int yEnd = dy < 0 ? SPRITE_SIZE + dy : SPRITE_SIZE;
+    for (int y = y0; y < yEnd; y++) {
+        uint64_t row = mask2[y - dy];
+        row = dx >= 0 ? row << dx : row >> -dx;
+        if (mask1[y] & row) return 1;
+    }
+    return 0;
+}
+
+int isScrolledToScreen(int x, int y, int screenWidth) {
+    return (y + SPRITE_SIZE > 0) && (x + SPRITE_SIZE > 0) && (x < screenWidth);
+}
+
+int isScrolledOutOfScreen(int x, int y, int screenHeight) {
+    return (x <= -SPRITE_SIZE) || (y >= screenHeight);
+}
+
+void setToasterSpawnCoordinates(struct Toaster *toaster, int screenWidth, int screenHeight) {
+    int slotWidth = screenWidth / GRID_WIDTH;
+    int slotHeight = screenHeight / GRID_HEIGHT;
+    toaster->x = (screenHeight + (toaster->slot % GRID_WIDTH) * slotWidth + (slotWidth - SPRITE_SIZE) / 2) * FP_ONE;
+    toaster->y = (-screenHeight + (toaster->slot / GRID_WIDTH) * slotHeight + (slotHeight - SPRITE_SIZE) / 2) * FP_ONE;
+    toaster->prevX = toaster->x;
+    toaster->prevY = toaster->y;
+}
+
+void setToastSpawnCoordinates(struct Toast *toast, int screenWidth, int screenHeight) {
+    int slotWidth = screenWidth / GRID_WIDTH;
+    int slotHeight = screenHeight / GRID_HEIGHT;
+    toast->x = (screenHeight + (toast->slot % GRID_WIDTH) * slotWidth + (slotWidth - SPRITE_SIZE) / 2) * FP_ONE;
+    toast->y = (-screenHeight + (toast->slot / GRID_WIDTH) * slotHeight + (slotHeight - SPRITE_SIZE) / 2) * FP_ONE;
+    toast->prevX = toast->x;
+    toast->prevY = toast->y;
+}
+
+/* Opaque pixels as the compositor sees them: decoded by the same parser,
+ * everything but the XPM's "None" colour. */
+static void buildSpriteMask(char **xpm, uint64_t *rows) {
+    int width = 0, height = 0;
+    uint32_t *argb = xpm_to_argb((const char *const *)xpm, &width, &height);
+    for (int y = 0; y < SPRITE_SIZE; y++) {
+        uint64_t row = 0;
+        for (int x = 0; argb && y < height && x < width && x < SPRITE_SIZE; x++) {
+            if (argb[y * width + x] >> 24) row |= 1ULL << x;
+        }
+        rows[y] = row;
+    }
+    free(argb);
+}
+
+static void initGrid(struct Simulation *sim, int *grid, int count) {
+    for (int i = 0; i < count; i++) {
+        grid[i] = i;
+    }
+    for (int i = 0; i < count - 1; i++) {
+        int j = i + nextRandom(sim, count - i);
+        int t = grid[j];
+        grid[j] = grid[i];
+        grid[i] = t;
+    }
+}
+
+void initSimulation(struct Simulation *sim, int width, int height,
+                    int toasterCount, int toastCount, int tickHz, uint32_t seed) {
+    int grid[MAX_ENTITIES];
+    sim->width = width;
+    sim->height = height;
+    sim->toasterCount = toasterCount;
+    sim->toastCount = toastCount;
+    sim->tickHz = tickHz;
+    sim->tickNs = 1000000000u / (unsigned)tickHz;
+    sim->accumulator = 0;
+    sim->stepScale = (SIM_BASE_HZ << FP_SHIFT) / tickHz;
+    sim->stepRemainder = 0;
+    sim->animClock = 0;
+    sim->frameCounter = 0;
+    sim->rng = seed ? seed : 1;   /* xorshift must not start at zero */
+    for (int i = 0; i < TOASTER_SPRITE_COUNT; i++) {
+        buildSpriteMask(toasterXpm[i], sim->toasterMasks[i]);
+    }
+
+    initGrid(sim, grid, toasterCount + toastCount);
+    for (int i = 0; i < toasterCount; i++) {
+        struct Toaster *t = &sim->toasters[i];
+        t->slot = grid[i];
+        t->moveDistance = 1 + nextRandom(sim, MAX_TOASTER_SPEED);
+        t->currentFrame = nextRandom(sim, TOASTER_SPRITE_COUNT);
+        setToasterSpawnCoordinates(t, width, height);
+    }
+    for (int i = 0; i < toastCount; i++) {
+        struct Toast *t = &sim->toasts[i];
+        t->slot = grid[toasterCount + i];
+        t->moveDistance = 1 + nextRandom(sim, MAX_TOAST_SPEED);
+        setToastSpawnCoordinates(t, width, height);
+    }
+}
+
+void stepSimulation(struct Simulation *sim) {
+    /* Every tickHz ticks add up to exactly SIM_BASE_HZ base-rate frames. */
+    int step = (SIM_BASE_HZ << FP_SHIFT) + sim->stepRemainder;
+    sim->stepScale = step / sim->tickHz;
+    sim->stepRemainder = step % sim->tickHz;
+
+    int width = sim->width, height = sim->height;
+
+    for (int i = 0; i < sim->toastCount; i++) {
+        struct Toast *t = &sim->toasts[i];
+        int v = t->moveDistance * sim->stepScale;
+        int newX = t->x - v;
+        int newY = t->y + v;
+        if (isScrolledOutOfScreen(toPixels(newX), toPixels(newY), height)) {
+            setToastSpawnCoordinates(t, width, height);
+        } else {
+            t->prevX = t->x;
+            t->prevY = t->y;
+            t->x = newX;
+            t->y = newY;
+        }
+    }
+
+    /* Animation counts base-rate frames so flapping speed is tick-rate independent. */
+    int prevFrames = sim->animClock >> FP_SHIFT;
+    sim->animClock += sim->stepScale;
+    int frames = (sim->animClock >> FP_SHIFT) - prevFrames;
+    sim->animClock &= (256 << FP_SHIFT) - 1;
+
+    for (int i = 0; i < sim->toasterCount; i++) {
+        struct Toaster *t = &sim->toasters[i];
+        int v = t->moveDistance * sim->stepScale;
+        int newX = t->x - v;
+        int newY = t->y + v;
+        if (isScrolledOutOfScreen(toPixels(newX), toPixels(newY), height)) {
+            setToasterSpawnCoordinates(t, width, height);
+        } else {
+            for (int j = 0; j < sim->toasterCount; j++) {
+                struct Toaster *o = &sim->toasters[j];
+                if (i != j && hasSpriteCollision(toPixels(o->x), toPixels(o->y),
+                                                 toPixels(newX), toPixels(newY), 0) &&
+                    hasPixelCollision(sim->toasterMasks[o->currentFrame], toPixels(o->x), toPixels(o->y),
+                                      sim->toasterMasks[t->currentFrame], toPixels(newX), toPixels(newY))) {
+                    if (t->x <= o->x + SPRITE_SIZE * FP_ONE) {
+                        newY = t->y + o->moveDistance * sim->stepScale;
+                    } else {
+                        newX = t->x - o->moveDistance * sim->stepScale;
+                    }
+                    break;
+                }
+            }
+            t->prevX = t->x;
+            t->prevY = t->y;
+            t->x = newX;
+            t->y = newY;
+        }
+        for (int f = 1; f <= frames; f++) {
+            int counter = (sim->frameCounter + f) % 256;
+            if (counter % (10 - t->moveDistance) == 0) {
+                t->currentFrame = (t->currentFrame + 1) % TOASTER_SPRITE_COUNT;
+            }
+        }
+    }
+    sim->frameCounter = (sim->frameCounter + frames) % 256;
+}
+
+int advanceSimulation(struct Simulation *sim, uint64_t elapsedNs) {
+    uint64_t limit = sim->tickNs * MAX_CATCH_UP_TICKS;
+    sim->accumulator += elapsedNs;
+    if (sim->accumulator > limit) sim->accumulator = limit;
+    int ticks = 0;
+    while (sim->accumulator >= sim->tickNs) {
+        stepSimulation(sim);
+        sim->accumulator -= sim->tickNs;
+        ticks++;
+    }
+    return ticks;
+}
+
+int simulationAlpha(const struct Simulation *sim) {
+    return (int)((sim->accumulator << FP_SHIFT) / sim->tickNs);
+}
+
+static int lerp(int from, int to, int alpha) {
+    return from + (int)(((int64_t)(to - from) * alpha) >> FP_SHIFT);
+}
+
+void toasterDrawPosition(const struct Simulation *sim, int i, int alpha, int *x, int *y) {
+    const struct Toaster *t = &sim->toasters[i];
+    *x = toPixels(lerp(t->prevX, t->x, alpha));
+    *y = toPixels(lerp(t->prevY, t->y, alpha));
+}
+
+void toastDrawPosition(const struct Simulation *sim, int i, int alpha, int *x, int *y) {
+    const struct Toast *t = &sim->toasts[i];
+    *x = toPixels(lerp(t->prevX, t->x, alpha));
+    *y = toPixels(lerp(t->prevY, t->y, alpha));
+}
@@ -0,0 +1,84 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stdint.h>
+
+#define TOASTER_SPRITE_COUNT 6
+#define SPRITE_SIZE 64
+#define GRID_WIDTH 4
+#define GRID_HEIGHT 4
+#define MAX_ENTITIES (GRID_WIDTH * GRID_HEIGHT)  /* one spawn slot each */
+
+/* Positions are 24.8 fixed point so motion can be finer than a pixel per tick. */
+#define FP_SHIFT 8
+#define FP_ONE (1 << FP_SHIFT)
+
+/* Speeds (moveDistance) are pixels per tick at this rate, as originally tuned. */
+#define SIM_BASE_HZ 60
+
+struct Toaster {
+    int slot;
+    int x;              /* fixed point */
+    int y;
+    int prevX;          /* position at the previous tick, for interpolation */
+    int prevY;
+    int moveDistance;
+    int currentFrame;
+};
+
+struct Toast {
+    int slot;
+    int x;
+    int y;
+    int prevX;
+    int prevY;
+    int moveDistance;
+};
+
+/* Fixed-timestep simulation, independent of the display rate. Renderers call
+ * advanceSimulation() with wall-clock time and draw interpolated positions. */
+struct Simulation {
+    int width;
+    int height;
+    int toasterCount;
+    int toastCount;
+    struct Toaster toasters[MAX_ENTITIES];
+    struct Toast toasts[MAX_ENTITIES];
+    int tickHz;
+    uint64_t tickNs;
+    uint64_t accumulator;   /* wall-clock time not yet simulated */
+    int stepScale;          /* base-rate frames in the current tick, fixed point */
+    int stepRemainder;      /* carried so tick rates that don't divide SIM_BASE_HZ keep exact speed */
+    int animClock;          /* base-rate frames elapsed, fixed point */
+    int frameCounter;
+    uint32_t rng;           /* spawn randomness, seeded so runs can be replayed */
+    /* Opaque pixels of each toaster frame: bit x of row y is set where the
+     * sprite is drawn. Built from the XPM data by initSimulation(). */
+    uint64_t toasterMasks[TOASTER_SPRITE_COUNT][SPRITE_SIZE];
+};
+
+int hasSpriteCollision(int x1, int y1, int x2, int y2, int gap);
+/* Narrow phase after hasSpriteCollision(): whether the opaque pixels of two
+ * sprites, given as one 64-bit mask per row, overlap. */
+int hasPixelCollision(const uint64_t *mask1, int x1, int y1, const uint64_t *mask2, int x2, int y2);
+int isScrolledToScreen(int x, int y, int screenWidth);
+int isScrolledOutOfScreen(int x, int y, int screenHeight);
+
+void setToasterSpawnCoordinates(struct Toaster *toaster, int screenWidth, int screenHeight);
+void setToastSpawnCoordinates(struct Toast *toast, int screenWidth, int screenHeight);
+
+/* Spawn all entities; toasterCount + toastCount must not exceed MAX_ENTITIES.
+ * The same seed always produces the same run. */
+void initSimulation(struct Simulation *sim, int width, int height,
+                    int toasterCount, int toastCount, int tickHz, uint32_t seed);
+void stepSimulation(struct Simulation *sim);
+/* Run as many whole ticks as fit in the accumulated time; returns ticks run. */
+int advanceSimulation(struct Simulation *sim, uint64_t elapsedNs);
+/* Fraction of the next tick already elapsed, in [0, FP_ONE). */
+int simulationAlpha(const struct Simulation *sim);
+
+/* Interpolated on-screen position in whole pixels. */
+void toasterDrawPosition(const struct Simulation *sim, int i, int alpha, int *x, int *y);
+void toastDrawPosition(const struct Simulation *sim, int i, int alpha, int *x, int *y);
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Safe reuse of Unix socket paths given on the command line.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "sockpath.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+int claim_socket_path(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        if (errno == ENOENT) return 0;
+        fprintf(stderr, "flying-toasters: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "flying-toasters: %s exists and is not a socket\n", path);
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("flying-toasters: socket");
+        return -1;
+    }
+    int connected = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    int err = errno;
+    close(fd);
+    if (connected) {
+        fprintf(stderr, "flying-toasters: %s is in use by another process\n", path);
+        return -1;
+    }
+    if (err != ECONNREFUSED) {
+        fprintf(stderr, "flying-toasters: %s: %s\n", path, strerror(err));
+        return -1;
+    }
+    if (unlink(path) != 0 && errno != ENOENT) {
+        fprintf(stderr, "flying-toasters: cannot remove stale socket %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef SOCKPATH_H
+#define SOCKPATH_H
+
+/* Make a Unix socket path free to bind. Nothing there is fine; a socket
+ * nobody is listening on is left over from a crashed run and is removed.
+ * Refuses, with a message, when the path is not a socket or another process
+ * is still serving it. Returns 0 when the caller may bind, -1 otherwise. */
+int claim_socket_path(const char *path);
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * Golden-frame check (-verify): replays a fixed-seed run and hashes every
+ * composited frame from each renderer. All renderers must agree pixel for
+ * pixel, and checkpoint hashes must match src/golden.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include "../img/toast.xpm"
+#include "../img/toaster.xpm"
+#include "flying-toasters.h"
+#include "golden.h"
+#ifdef HAVE_XSCREENSAVER_X11
+#include "xscreensaver-x11.h"
+#endif
+
+#define VERIFY_TOASTERS 10
+#define VERIFY_TOASTS 6
+#define VERIFY_TICK_HZ 30           /* half the frame rate, so frames interpolate */
+#define VERIFY_FRAME_NS 16666667u
+
+static const struct PixelFormat rgb = { 0xff0000, 0xff00, 0xff };
+
+/* FNV-1a over the RGB bytes; alpha and padding are not part of the image. */
+static uint64_t hash_pixels(uint64_t h, const uint32_t *pixels, int width, int height, int stride) {
+    for (int y = 0; y < height; y++) {
+        const uint32_t *row = pixels + (size_t)y * stride;
+        for (int x = 0; x < width; x++) {
+            uint32_t px = row[x];
+            for (int b = 0; b < 3; b++) {
+                h ^= (px >> (8 * b)) & 0xff;
+                h *= 0x100000001b3ULL;
+            }
+        }
+    }
+    return h;
+}
+
+static uint64_t hash_ints(uint64_t h, const int *values, int count) {
+    for (int i = 0; i < count; i++) {
+        uint32_t v = (uint32_t)values[i];
+        for (int b = 0; b < 4; b++) {
+            h ^= (v >> (8 * b)) & 0xff;
+            h *= 0x100000001b3ULL;
+        }
+    }
+    return h;
+}
+
+static uint64_t hash_positions(const struct Simulation *sim, int alpha) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < sim->toastCount; i++) {
+        int v[2];
+        toastDrawPosition(sim, i, alpha, &v[0], &v[1]);
+        h = hash_ints(h, v, 2);
+    }
+    for (int i = 0; i < sim->toasterCount; i++) {
+        int v[3];
+        toasterDrawPosition(sim, i, alpha, &v[0], &v[1]);
+        v[2] = sim->toasters[i].currentFrame;
+        h = hash_ints(h, v, 3);
+    }
+    return h;
+}
+
+/* Same draw list as the SDL loop in main(): toasts, then toasters on top. */
+static int build_items(struct ComposeItem *items, const struct Simulation *sim, int alpha,
+                       const struct CompositorSprite *sprites, int width) {
+    int n = 0;
+    for (int i = 0; i < sim->toastCount; i++) {
+        int x, y;
+        toastDrawPosition(sim, i, alpha, &x, &y);
+        if (isScrolledToScreen(x, y, width))
+            items[n++] = (struct ComposeItem){ &sprites[TOASTER_SPRITE_COUNT], x, y };
+    }
+    for (int i = 0; i < sim->toasterCount; i++) {
+        int x, y;
+        toasterDrawPosition(sim, i, alpha, &x, &y);
+        if (isScrolledToScreen(x, y, width))
+            items[n++] = (struct ComposeItem){ &sprites[sim->toasters[i].currentFrame], x, y };
+    }
+    return n;
+}
+
+static void draw_textures(SDL_Renderer *renderer, SDL_Texture **toasterTextures, SDL_Texture *toastTexture,
+                          const struct Simulation *sim, int alpha, int width) {
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    for (int i = 0; i < sim->toastCount; i++) {
+        int x, y;
+        toastDrawPosition(sim, i, alpha, &x, &y);
+        if (isScrolledToScreen(x, y, width)) drawSprite(renderer, toastTexture, x, y);
+    }
+    for (int i = 0; i < sim->toasterCount; i++) {
+        int x, y;
+        toasterDrawPosition(sim, i, alpha, &x, &y);
+        if (isScrolledToScreen(x, y, width))
+            drawSprite(renderer, toasterTextures[sim->toasters[i].currentFrame], x, y);
+    }
+}
+
+enum { PATH_SDL_TEXTURES, PATH_SDL_COMPOSITE, PATH_X11_COMPOSITE, PATH_X11_XPUTPIXEL, PATH_X11_INDEXED,
+       PATH_X11_PIXMAPS, PATH_COUNT };
+static const char *const pathNames[PATH_COUNT] = {
+    "sdl-textures", "sdl-composite", "x11-composite", "x11-xputpixel", "x11-indexed",
+    "x11-pixmaps"
+};
+#define X11_PATHS 4
+
+int run_verify(int update) {
+    const int width = GOLDEN_WIDTH, height = GOLDEN_HEIGHT;
+    size_t frameBytes = (size_t)width * height * sizeof(uint32_t);
+    uint32_t *texturePixels = malloc(frameBytes);
+    uint32_t *compositePixels = malloc(frameBytes);
+    struct CompositorSprite *sprites = malloc(sizeof(*sprites) * (TOASTER_SPRITE_COUNT + 1));
+    struct Compositor compositor;
+    int ok = texturePixels && compositePixels && sprites;
+    for (int i = 0; ok && i < TOASTER_SPRITE_COUNT; i++)
+        ok = compositor_load_sprite(&sprites[i], (const char *const *)toasterXpm[i], &rgb, NULL) == 0;
+    if (ok)
+        ok = compositor_load_sprite(&sprites[TOASTER_SPRITE_COUNT], (const char *const *)toastXpm, &rgb, NULL) == 0;
+    if (ok)
+        ok = compositor_init(&compositor, compositePixels, width, height, width, 0, COMPOSE_FRONT_TO_BACK) == 0;
+    if (!ok) {
+        fprintf(stderr, "flying-toasters: verify setup failed\n");
+        free(texturePixels); free(compositePixels); free(sprites);
+        return 1;
+    }
+
+    /* SDL's software renderer draws into a plain surface, so no window is needed. */
+    SDL_Surface *target = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+    SDL_Renderer *renderer = target ? SDL_CreateSoftwareRenderer(target) : NULL;
+    SDL_Texture *toasterTextures[TOASTER_SPRITE_COUNT];
+    SDL_Texture *toastTexture = NULL;
+    if (renderer) loadSprites(renderer, toasterTextures, &toastTexture);
+    if (!toastTexture) fprintf(stderr, "flying-toasters: skipping sdl-textures: %s\n", SDL_GetError());
+
+#ifdef HAVE_XSCREENSAVER_X11
+    /* In PATH_X11_* order. */
+    static const enum X11RenderMode x11Modes[X11_PATHS] = {
+        X11_RENDER_DIRECT, X11_RENDER_LEGACY, X11_RENDER_INDEXED, X11_RENDER_PIXMAP
+    };
+    struct X11Offscreen *x11[X11_PATHS];
+    for (int p = 0; p < X11_PATHS; p++)
+        x11[p] = x11_offscreen_open(width, height, x11Modes[p]);
+#endif
+
+    struct Simulation sim;
+    initSimulation(&sim, width, height, VERIFY_TOASTERS, VERIFY_TOASTS, VERIFY_TICK_HZ, GOLDEN_SEED);
+
+    struct ComposeItem items[2 * MAX_ENTITIES];
+    uint64_t frameHashes[GOLDEN_CHECKPOINTS], positionHashes[GOLDEN_CHECKPOINTS];
+    int checked[PATH_COUNT] = { 0 };
+    int mismatches = 0;
+
+    for (int f = 0; f < GOLDEN_FRAMES; f++) {
+        advanceSimulation(&sim, VERIFY_FRAME_NS);
+        int alpha = simulationAlpha(&sim);
+
+        compositor_draw(&compositor, items, build_items(items, &sim, alpha, sprites, width));
+        uint64_t reference = hash_pixels(0xcbf29ce484222325ULL, compositePixels, width, height, width);
+        checked[PATH_SDL_COMPOSITE]++;
+
+        uint64_t hashes[PATH_COUNT] = { 0 };
+        if (toastTexture) {
+            draw_textures(renderer, toasterTextures, toastTexture, &sim, alpha, width);
+            SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_ARGB8888, texturePixels, width * 4);
+            hashes[PATH_SDL_TEXTURES] = hash_pixels(0xcbf29ce484222325ULL, texturePixels, width, height, width);
+        }
+#ifdef HAVE_XSCREENSAVER_X11
+        for (int p = 0; p < X11_PATHS; p++) {
+            if (x11[p])
+                hashes[PATH_X11_COMPOSITE + p] = hash_pixels(0xcbf29ce484222325ULL,
+                    x11_offscreen_render(x11[p], &sim, alpha), width, height, width);
+        }
+#endif
+        for (int p = 0; p < PATH_COUNT; p++) {
+            if (p == PATH_SDL_COMPOSITE || !hashes[p]) continue;
+            checked[p]++;
+            if (hashes[p] != reference) {
+                if (mismatches++ < 10)
+                    fprintf(stderr, "frame %d: %s differs from sdl-composite\n", f, pathNames[p]);
+            }
+        }
+
+        if ((f + 1) % GOLDEN_INTERVAL == 0) {
+            int c = f / GOLDEN_INTERVAL;
+            frameHashes[c] = reference;
+            positionHashes[c] = hash_positions(&sim, alpha);
+            if (!update && (frameHashes[c] != goldenFrameHashes[c] ||
+                            positionHashes[c] != goldenPositionHashes[c])) {
+                fprintf(stderr, "frame %d: %s hash differs from golden\n", f,
+                        positionHashes[c] != goldenPositionHashes[c] ? "position" : "pixel");
+                mismatches++;
+            }
+        }
+    }
+
+    /* A path that could not run was never compared, so it fails the check;
+     * only X11 paths left out of the build are exempt. */
+    int missing = 0;
+    for (int p = 0; p < PATH_COUNT; p++) {
+#ifndef HAVE_XSCREENSAVER_X11
+        if (p >= PATH_X11_COMPOSITE) {
+            printf("  %-14s not built\n", pathNames[p]);
+            continue;
+        }
+#endif
+        printf("  %-14s %s\n", pathNames[p], checked[p] ? "checked" : "unavailable");
+        if (!checked[p]) missing++;
+    }
+    if (update) {
+        printf("static const uint64_t goldenFrameHashes[GOLDEN_CHECKPOINTS] = {\n");
+        for (int c = 0; c < GOLDEN_CHECKPOINTS; c++)
+            printf("    0x%016llxULL,\n", (unsigned long long)frameHashes[c]);
+        printf("};\nstatic const uint64_t goldenPositionHashes[GOLDEN_CHECKPOINTS] = {\n");
+        for (int c = 0; c < GOLDEN_CHECKPOINTS; c++)
+            printf("    0x%016llxULL,\n", (unsigned long long)positionHashes[c]);
+        printf("};\n");
+    }
+    printf("flying-toasters verify: %d frames at %dx%d, %s\n", GOLDEN_FRAMES, width, height,
+           mismatches || missing ? "FAILED" : "ok");
+
+#ifdef HAVE_XSCREENSAVER_X11
+    for (int p = 0; p < X11_PATHS; p++)
+        x11_offscreen_close(x11[p]);
+#endif
+    if (toastTexture) freeSprites(toasterTextures, toastTexture);
+    if (renderer) SDL_DestroyRenderer(renderer);
+    if (target) SDL_FreeSurface(target);
+    compositor_free(&compositor);
+    free(texturePixels); free(compositePixels); free(sprites);
+    return mismatches || missing ? 1 : 0;
+}
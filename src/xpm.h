@@ -2,6 +2,7 @@
 #define XPM_H
 
 #include <SDL.h>
+#include "xpmdecode.h"
 
 /* Parse XPM data (array of strings) into an SDL_Surface with transparency.
  * Returns NULL on error. Caller must free with SDL_FreeSurface. */
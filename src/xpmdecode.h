@@ -0,0 +1,10 @@
+#ifndef XPMDECODE_H
+#define XPMDECODE_H
+
+#include <stdint.h>
+
+/* Parse XPM data into a malloc'd array of 0xAARRGGBB pixels; transparent
+ * ("None") pixels have alpha 0. Returns NULL on error. Caller must free. */
+uint32_t *xpm_to_argb(const char *const *xpm_data, int *width, int *height);
+
+#endif
@@ -5,58 +5,28 @@
 #define _POSIX_C_SOURCE 200112L
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <stdio.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/xpm.h>
+#include <X11/extensions/dpms.h>
 #include "../img/toast.xpm"
 #include "../img/toaster.xpm"
+#include "compositor.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "simulation.h"
+#include "xscreensaver-x11.h"
 
-#define TOASTER_SPRITE_COUNT 6
 #define TOASTER_COUNT 6   /* Fewer sprites for Pi/X11 performance */
 #define TOAST_COUNT 4
-#define SPRITE_SIZE 64
-#define GRID_WIDTH 4
-#define GRID_HEIGHT 4
-#define MAX_TOASTER_SPEED 4
-#define MAX_TOAST_SPEED 3
-#define FPS 60            /* One XPutImage per frame - fast enough now */
-
-struct Toaster { int slot, x, y, moveDistance, currentFrame; };
-struct Toast { int slot, x, y, moveDistance; };
-
-static int hasSpriteCollision(int x1, int y1, int x2, int y2, int gap) {
-    return (x1 < x2 + SPRITE_SIZE + gap) && (x2 < x1 + SPRITE_SIZE + gap) &&
-           (y1 < y2 + SPRITE_SIZE + gap) && (y2 < y1 + SPRITE_SIZE + gap);
-}
-static int isScrolledToScreen(int x, int y, int w) {
-    return (y + SPRITE_SIZE > 0) && (x + SPRITE_SIZE > 0) && (x < w);
-}
-static int isScrolledOutOfScreen(int x, int y, int h) {
-    return (x <= -SPRITE_SIZE) || (y >= h);
-}
-
-static void setToasterSpawn(struct Toaster *t, int w, int h) {
-    int sw = w / GRID_WIDTH, sh = h / GRID_HEIGHT;
-    t->x = h + (t->slot % GRID_WIDTH) * sw + (sw - SPRITE_SIZE) / 2;
-    t->y = -h + (t->slot / GRID_WIDTH) * sh + (sh - SPRITE_SIZE) / 2;
-}
-static void setToastSpawn(struct Toast *t, int w, int h) {
-    int sw = w / GRID_WIDTH, sh = h / GRID_HEIGHT;
-    t->x = h + (t->slot % GRID_WIDTH) * sw + (sw - SPRITE_SIZE) / 2;
-    t->y = -h + (t->slot / GRID_WIDTH) * sh + (sh - SPRITE_SIZE) / 2;
-}
-
-static int *initGrid(void) {
-    static int g[TOASTER_COUNT + TOAST_COUNT];
-    for (int i = 0; i < TOASTER_COUNT + TOAST_COUNT; i++) g[i] = i;
-    for (int i = 0; i < TOASTER_COUNT + TOAST_COUNT - 1; i++) {
-        int j = i + rand() % (TOASTER_COUNT + TOAST_COUNT - i), t = g[j];
-        g[j] = g[i]; g[i] = t;
-    }
-    return g;
-}
+#define FPS 60
+#define FULL_REFRESH_FRAMES FPS   /* resend the whole frame this often when we get no Expose */
+#define DPMS_POLL_MS 1000         /* DPMS has no events, so poll the monitor state */
 
 static Window get_xscreensaver_window(Display *dpy) {
     (void)dpy;
@@ -83,36 +53,387 @@ static void blit_sprite(XImage *buf, XImage *sprite, XImage *mask, int dx, int d
     }
 }
 
-static void draw_x11_composite(Display *dpy, Window win, XImage *bufImg,
+static int xErrorSeen;
+
+static int note_x_error(Display *dpy, XErrorEvent *e) {
+    (void)dpy;
+    (void)e;
+    xErrorSeen = 1;
+    return 0;
+}
+
+/* Whether the monitor is on; true when DPMS is disabled or unavailable. */
+static int display_powered(Display *dpy) {
+    CARD16 level;
+    BOOL enabled;
+    if (!DPMSInfo(dpy, &level, &enabled)) return 1;
+    return !enabled || level == DPMSModeOn;
+}
+
+/* Drain queued events, tracking whether anything we draw can be seen and
+ * whether the window contents were lost. */
+static int handle_x11_events(Display *dpy, int *mapped, int *obscured, int *redraw) {
+    while (XPending(dpy)) {
+        XEvent e;
+        XNextEvent(dpy, &e);
+        switch (e.type) {
+        case MapNotify: *mapped = 1; break;
+        case UnmapNotify: *mapped = 0; break;
+        case VisibilityNotify: *obscured = e.xvisibility.state == VisibilityFullyObscured; break;
+        case Expose: *redraw = 1; break;
+        case DestroyNotify: return 0;
+        }
+    }
+    return 1;
+}
+
+static int host_byte_order(void) {
+    const unsigned short probe = 1;
+    return *(const unsigned char *)&probe ? LSBFirst : MSBFirst;
+}
+
+/* Sprite table for the compositor: toaster frames followed by the toast. */
+#define TOAST_SPRITE TOASTER_SPRITE_COUNT
+
+/* With a compositor frames are built front to back, writing each pixel once;
+ * otherwise fall back to per-pixel XPutPixel. An indexed compositor builds a
+ * byte-per-pixel frame for expand_damage(). Returns the rects that changed. */
+static int draw_x11_composite(Display *dpy, Window win, XImage *bufImg,
     XImage **toasterImg, XImage **toasterMaskImg, XImage *toastImg, XImage *toastMaskImg,
-    struct Toaster *toasters, struct Toast *toasts,
-    int width, int height, unsigned long black)
+    struct Compositor *comp, const struct CompositorSprite *sprites,
+    const struct Simulation *sim, int alpha,
+    int width, int height, unsigned long black, struct ComposeRect *damage)
 {
     (void)dpy;
     (void)win;
     (void)black;
+    if (comp) {
+        struct ComposeItem items[2 * MAX_ENTITIES];
+        int n = 0;
+        for (int i = 0; i < sim->toastCount; i++) {
+            int x, y;
+            toastDrawPosition(sim, i, alpha, &x, &y);
+            if (isScrolledToScreen(x, y, width))
+                items[n++] = (struct ComposeItem){ &sprites[TOAST_SPRITE], x, y };
+        }
+        for (int i = 0; i < sim->toasterCount; i++) {
+            int x, y;
+            toasterDrawPosition(sim, i, alpha, &x, &y);
+            if (isScrolledToScreen(x, y, width))
+                items[n++] = (struct ComposeItem){ &sprites[sim->toasters[i].currentFrame], x, y };
+        }
+        compositor_draw(comp, items, n);
+        if (comp->bytesPerPixel == 1)
+            return compositor_damage(comp, damage, MAX_DAMAGE_RECTS);
+        damage[0] = (struct ComposeRect){ 0, 0, width, height };
+        return 1;
+    }
+
     /* Clear buffer (0 is typically black for TrueColor) */
     memset(bufImg->data, 0, (size_t)bufImg->bytes_per_line * height);
 
-    for (int i = 0; i < TOAST_COUNT; i++) {
-        if (isScrolledToScreen(toasts[i].x, toasts[i].y, width))
-            blit_sprite(bufImg, toastImg, toastMaskImg, toasts[i].x, toasts[i].y, width, height);
+    for (int i = 0; i < sim->toastCount; i++) {
+        int x, y;
+        toastDrawPosition(sim, i, alpha, &x, &y);
+        if (isScrolledToScreen(x, y, width))
+            blit_sprite(bufImg, toastImg, toastMaskImg, x, y, width, height);
+    }
+    for (int i = 0; i < sim->toasterCount; i++) {
+        int x, y;
+        toasterDrawPosition(sim, i, alpha, &x, &y);
+        if (isScrolledToScreen(x, y, width)) {
+            int f = sim->toasters[i].currentFrame;
+            blit_sprite(bufImg, toasterImg[f], toasterMaskImg[f], x, y, width, height);
+        }
+    }
+    damage[0] = (struct ComposeRect){ 0, 0, width, height };
+    return 1;
+}
+
+/* Expand the damaged rects of an indexed frame into bufImg through lut. */
+static void expand_damage(const struct Compositor *comp, const uint32_t *lut, XImage *bufImg,
+                          const struct ComposeRect *damage, int rects) {
+    int bpp = bufImg->bits_per_pixel / 8;
+    for (int i = 0; i < rects; i++) {
+        char *dst = bufImg->data + (size_t)damage[i].y * bufImg->bytes_per_line + (size_t)damage[i].x * bpp;
+        compositor_expand(comp, lut, &damage[i], dst, bufImg->bytes_per_line / bpp, bpp);
+    }
+}
+
+static void put_damage(Display *dpy, Window win, GC gc, XImage *bufImg,
+                       const struct ComposeRect *damage, int rects) {
+    for (int i = 0; i < rects; i++) {
+        XPutImage(dpy, win, gc, bufImg, damage[i].x, damage[i].y, damage[i].x, damage[i].y,
+                  (unsigned)damage[i].w, (unsigned)damage[i].h);
+    }
+    XFlush(dpy);
+}
+
+/* An indexed frame on its way to the present thread. */
+struct X11Slot {
+    uint8_t *indices;
+    struct Compositor view;     /* compositor state for this frame, for expansion */
+    struct ComposeRect damage[MAX_DAMAGE_RECTS];
+    int rects;
+};
+
+/* Present thread: expands and uploads frame N while the main thread composes
+ * frame N+1. It talks to the server over its own connection, since Xlib
+ * connections are not shared between threads here. bufImg belongs to it. */
+struct X11Presenter {
+    Display *dpy;
+    Window win;
+    GC gc;
+    XImage *bufImg;
+    const uint32_t *lut;
+    struct X11Slot slots[PIPELINE_DEPTH];
+    struct FrameQueue ready;    /* composed, waiting to be presented */
+    struct FrameQueue free;     /* presented, ready to compose into */
+    uint64_t lastPresentNs;
+    pthread_t thread;
+};
+
+static void *present_frames(void *arg) {
+    struct X11Presenter *p = (struct X11Presenter *)arg;
+    int s;
+    while ((s = frame_queue_pop(&p->ready)) >= 0) {
+        struct X11Slot *slot = &p->slots[s];
+        uint64_t start = metrics_now_ns();
+        expand_damage(&slot->view, p->lut, p->bufImg, slot->damage, slot->rects);
+        put_damage(p->dpy, p->win, p->gc, p->bufImg, slot->damage, slot->rects);
+        __atomic_store_n(&p->lastPresentNs, metrics_now_ns() - start, __ATOMIC_RELAXED);
+        frame_queue_push(&p->free, s);
+    }
+    return NULL;
+}
+
+static void free_presenter_slots(struct X11Presenter *p) {
+    for (int i = 0; i < PIPELINE_DEPTH; i++) free(p->slots[i].indices);
+}
+
+static int start_presenter(struct X11Presenter *p, const char *display_name, Window win,
+                           XImage *bufImg, const uint32_t *lut, int width, int height) {
+    memset(p, 0, sizeof(*p));
+    p->win = win;
+    p->bufImg = bufImg;
+    p->lut = lut;
+    int ok = 1;
+    for (int i = 0; ok && i < PIPELINE_DEPTH; i++)
+        ok = (p->slots[i].indices = (uint8_t *)malloc((size_t)width * height)) != NULL;
+    if (!ok || !(p->dpy = XOpenDisplay(display_name))) {
+        free_presenter_slots(p);
+        return -1;
+    }
+    p->gc = XCreateGC(p->dpy, win, 0, NULL);
+    if (frame_queue_init(&p->ready) != 0 || frame_queue_init(&p->free) != 0) {
+        XFreeGC(p->dpy, p->gc);
+        XCloseDisplay(p->dpy);
+        free_presenter_slots(p);
+        return -1;
     }
-    for (int i = 0; i < TOASTER_COUNT; i++) {
-        if (isScrolledToScreen(toasters[i].x, toasters[i].y, width)) {
-            int f = toasters[i].currentFrame;
-            blit_sprite(bufImg, toasterImg[f], toasterMaskImg[f], toasters[i].x, toasters[i].y, width, height);
+    for (int i = 0; i < PIPELINE_DEPTH; i++) frame_queue_push(&p->free, i);
+    if (pthread_create(&p->thread, NULL, present_frames, p) != 0) {
+        frame_queue_destroy(&p->ready);
+        frame_queue_destroy(&p->free);
+        XFreeGC(p->dpy, p->gc);
+        XCloseDisplay(p->dpy);
+        free_presenter_slots(p);
+        return -1;
+    }
+    return 0;
+}
+
+static void stop_presenter(struct X11Presenter *p) {
+    frame_queue_close(&p->ready);
+    pthread_join(p->thread, NULL);
+    frame_queue_destroy(&p->ready);
+    frame_queue_destroy(&p->free);
+    XFreeGC(p->dpy, p->gc);
+    XCloseDisplay(p->dpy);
+    free_presenter_slots(p);
+}
+
+/* Server-side rendering for remote displays: sprites and their masks are
+ * uploaded once as Pixmaps, and each frame is a few requests per sprite
+ * drawing into a back-buffer Pixmap, instead of pixels on the wire. */
+struct X11Pixmaps {
+    Pixmap sprite[TOASTER_SPRITE_COUNT + 1];
+    Pixmap mask[TOASTER_SPRITE_COUNT + 1];
+    Pixmap back;
+    GC spriteGC;    /* clipped to each sprite's mask in turn */
+    GC eraseGC;     /* fills with the background */
+    GC copyGC;      /* back buffer to window, clipped to the changed rects */
+    XRectangle drawn[MAX_ENTITIES];   /* sprites in the back buffer */
+    int drawnCount;
+    int fullDamage;
+    int width, height;
+    /* Without a display (-verify), images stand in for the server's
+     * drawables and the same requests are carried out on them. */
+    XImage *backImg, *windowImg;
+    XImage **spriteImg, **maskImg;
+};
+
+/* Local connections are Unix sockets; anything else, including ssh -X
+ * forwarding to localhost, crosses a network. FLYING_TOASTERS_X11_PIXMAPS=1
+ * or 0 overrides the guess. */
+static int use_server_pixmaps(Display *dpy) {
+    const char *env = getenv("FLYING_TOASTERS_X11_PIXMAPS");
+    if (env && *env) return strcmp(env, "0") != 0;
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(ConnectionNumber(dpy), (struct sockaddr *)&addr, &len) != 0) return 0;
+    return addr.ss_family != AF_UNIX;
+}
+
+static void free_pixmaps(struct X11Pixmaps *p, Display *dpy) {
+    for (int i = 0; i <= TOASTER_SPRITE_COUNT; i++) {
+        if (p->sprite[i]) XFreePixmap(dpy, p->sprite[i]);
+        if (p->mask[i]) XFreePixmap(dpy, p->mask[i]);
+    }
+    if (p->back) XFreePixmap(dpy, p->back);
+    if (p->spriteGC) XFreeGC(dpy, p->spriteGC);
+    if (p->eraseGC) XFreeGC(dpy, p->eraseGC);
+    if (p->copyGC) XFreeGC(dpy, p->copyGC);
+}
+
+static int load_pixmaps(struct X11Pixmaps *p, Display *dpy, Window win,
+                        const XWindowAttributes *xwa, unsigned long black) {
+    memset(p, 0, sizeof(*p));
+    p->width = xwa->width;
+    p->height = xwa->height;
+    for (int i = 0; i <= TOASTER_SPRITE_COUNT; i++) {
+        XpmAttributes attrs;
+        attrs.valuemask = XpmVisual | XpmColormap | XpmDepth;
+        attrs.visual = xwa->visual;
+        attrs.colormap = xwa->colormap;
+        attrs.depth = (unsigned)xwa->depth;
+        char **xpm = i == TOAST_SPRITE ? toastXpm : toasterXpm[i];
+        int status = XpmCreatePixmapFromData(dpy, win, xpm, &p->sprite[i], &p->mask[i], &attrs);
+        XpmFreeAttributes(&attrs);
+        if (status != XpmSuccess) {
+            free_pixmaps(p, dpy);
+            return -1;
         }
     }
+    p->back = XCreatePixmap(dpy, win, (unsigned)p->width, (unsigned)p->height, (unsigned)xwa->depth);
+    XGCValues values;
+    values.foreground = black;
+    values.graphics_exposures = False;
+    p->spriteGC = XCreateGC(dpy, p->back, GCGraphicsExposures, &values);
+    p->eraseGC = XCreateGC(dpy, p->back, GCForeground, &values);
+    p->copyGC = XCreateGC(dpy, win, GCGraphicsExposures, &values);
+    XFillRectangle(dpy, p->back, p->eraseGC, 0, 0, (unsigned)p->width, (unsigned)p->height);
+    p->fullDamage = 1;
+    return 0;
 }
 
-int run_xscreensaver_x11(void) {
+static void draw_pixmap_sprite(Display *dpy, struct X11Pixmaps *p, int sprite, int x, int y) {
+    if (dpy) {
+        XSetClipMask(dpy, p->spriteGC, p->mask[sprite]);
+        XSetClipOrigin(dpy, p->spriteGC, x, y);
+        XCopyArea(dpy, p->sprite[sprite], p->back, p->spriteGC, 0, 0, SPRITE_SIZE, SPRITE_SIZE, x, y);
+    } else {
+        blit_sprite(p->backImg, p->spriteImg[sprite], p->maskImg[sprite], x, y, p->width, p->height);
+    }
+    p->drawn[p->drawnCount++] = (XRectangle){ (short)x, (short)y, SPRITE_SIZE, SPRITE_SIZE };
+}
+
+/* Offscreen XFillRectangles/XCopyArea: copy (or, without src, clear) the
+ * rects of dst, clipped to the image. */
+static void copy_image_rects(XImage *dst, XImage *src, const XRectangle *rects, int n) {
+    for (int i = 0; i < n; i++) {
+        int x0 = rects[i].x < 0 ? 0 : rects[i].x;
+        int y0 = rects[i].y < 0 ? 0 : rects[i].y;
+        int x1 = rects[i].x + rects[i].width, y1 = rects[i].y + rects[i].height;
+        if (x1 > dst->width) x1 = dst->width;
+        if (y1 > dst->height) y1 = dst->height;
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++)
+                XPutPixel(dst, x, y, src ? XGetPixel(src, x, y) : 0);
+    }
+}
+
+/* Erase the sprites' old rects in the back buffer, draw them at their new
+ * positions, then copy only the old and new rects to the window. */
+static void draw_x11_pixmaps(Display *dpy, Window win, struct X11Pixmaps *p,
+                             const struct Simulation *sim, int alpha) {
+    XRectangle changed[2 * MAX_ENTITIES];
+    int n = p->drawnCount;
+    memcpy(changed, p->drawn, sizeof(*changed) * (size_t)n);
+    if (n && dpy) XFillRectangles(dpy, p->back, p->eraseGC, p->drawn, n);
+    else if (n) copy_image_rects(p->backImg, NULL, p->drawn, n);
+    p->drawnCount = 0;
+
+    /* Toasts first so toasters draw on top. */
+    int x, y;
+    for (int i = 0; i < sim->toastCount; i++) {
+        toastDrawPosition(sim, i, alpha, &x, &y);
+        if (isScrolledToScreen(x, y, p->width)) draw_pixmap_sprite(dpy, p, TOAST_SPRITE, x, y);
+    }
+    for (int i = 0; i < sim->toasterCount; i++) {
+        toasterDrawPosition(sim, i, alpha, &x, &y);
+        if (isScrolledToScreen(x, y, p->width))
+            draw_pixmap_sprite(dpy, p, sim->toasters[i].currentFrame, x, y);
+    }
+
+    memcpy(changed + n, p->drawn, sizeof(*changed) * (size_t)p->drawnCount);
+    n += p->drawnCount;
+    if (p->fullDamage) {
+        changed[0] = (XRectangle){ 0, 0, (unsigned short)p->width, (unsigned short)p->height };
+        n = 1;
+        p->fullDamage = 0;
+    }
+    if (n && !dpy) {
+        copy_image_rects(p->windowImg, p->backImg, changed, n);
+    } else if (n) {
+        /* Old and new rects overlap, and overlapping clip rectangles are
+         * undefined in X, so clip to their union instead. */
+        Region clip = XCreateRegion();
+        for (int i = 0; i < n; i++) XUnionRectWithRegion(&changed[i], clip, clip);
+        XSetRegion(dpy, p->copyGC, clip);
+        XDestroyRegion(clip);
+        XCopyArea(dpy, p->back, win, p->copyGC, 0, 0, (unsigned)p->width, (unsigned)p->height, 0, 0);
+    }
+}
+
+static void free_sprite_images(XImage **toasterImg, XImage **toasterMaskImg,
+                               XImage *toastImg, XImage *toastMaskImg) {
+    for (int i = 0; i < TOASTER_SPRITE_COUNT; i++) {
+        if (toasterImg[i]) XDestroyImage(toasterImg[i]);
+        if (toasterMaskImg[i]) XDestroyImage(toasterMaskImg[i]);
+    }
+    if (toastImg) XDestroyImage(toastImg);
+    if (toastMaskImg) XDestroyImage(toastMaskImg);
+}
+
+/* Client-side sprite and mask images for the compositor and XPutPixel paths. */
+static int load_sprite_images(Display *dpy, XImage **toasterImg, XImage **toasterMaskImg,
+                              XImage **toastImg, XImage **toastMaskImg) {
+    for (int i = 0; i < TOASTER_SPRITE_COUNT; i++) {
+        if (XpmCreateImageFromData(dpy, toasterXpm[i], &toasterImg[i], &toasterMaskImg[i], NULL) != 0) {
+            fprintf(stderr, "flying-toasters: failed to load toaster sprite %d\n", i);
+            free_sprite_images(toasterImg, toasterMaskImg, NULL, NULL);
+            return -1;
+        }
+    }
+    if (XpmCreateImageFromData(dpy, toastXpm, toastImg, toastMaskImg, NULL) != 0) {
+        fprintf(stderr, "flying-toasters: failed to load toast sprite\n");
+        free_sprite_images(toasterImg, toasterMaskImg, NULL, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+int run_xscreensaver_x11(int tickHz, uint32_t seed) {
     const char *display_name = getenv("DISPLAY");
     if (!display_name || !*display_name) {
         display_name = ":0";
         setenv("DISPLAY", ":0", 1);
     }
 
+    /* Frames may be presented from a second thread on its own connection,
+     * and Xlib's global state is only thread-safe after this. */
+    XInitThreads();
     Display *dpy = XOpenDisplay(display_name);
     if (!dpy) {
         fprintf(stderr, "flying-toasters: cannot open display %s\n", display_name);
@@ -126,8 +447,18 @@ int run_xscreensaver_x11(void) {
         return 1;
     }
 
-    /* Don't XSelectInput - xscreensaver's window may deny attribute changes (BadAccess).
-     * XScreensaver will kill our process when user activates. */
+    /* Watch for the window being unmapped, covered or exposed. xscreensaver's
+     * window may deny attribute changes (BadAccess); then we just keep drawing
+     * until xscreensaver kills our process when the user activates. */
+    XErrorHandler oldHandler = XSetErrorHandler(note_x_error);
+    xErrorSeen = 0;
+    XSelectInput(dpy, win, VisibilityChangeMask | StructureNotifyMask | ExposureMask);
+    XSync(dpy, False);
+    XSetErrorHandler(oldHandler);
+    int watching = !xErrorSeen;
+
+    int dpmsEvent, dpmsError;
+    int haveDpms = DPMSQueryExtension(dpy, &dpmsEvent, &dpmsError) && DPMSCapable(dpy);
 
     XWindowAttributes xwa;
     if (!XGetWindowAttributes(dpy, win, &xwa)) {
@@ -144,130 +475,317 @@ int run_xscreensaver_x11(void) {
     unsigned long black = BlackPixelOfScreen(screen);
     GC gc = XCreateGC(dpy, win, 0, NULL);
 
-    XImage *toasterImg[TOASTER_SPRITE_COUNT];
-    XImage *toasterMaskImg[TOASTER_SPRITE_COUNT];
-    XImage *clipMask = NULL;
+    /* On a remote display, keep the sprites on the server and send requests
+     * rather than pixels; none of the client-side images are needed then. */
+    struct X11Pixmaps serverPixmaps;
+    struct X11Pixmaps *pixmaps = NULL;
+    if (use_server_pixmaps(dpy) && load_pixmaps(&serverPixmaps, dpy, win, &xwa, black) == 0)
+        pixmaps = &serverPixmaps;
 
-    for (int i = 0; i < TOASTER_SPRITE_COUNT; i++) {
-        if (XpmCreateImageFromData(dpy, toasterXpm[i], &toasterImg[i], &clipMask, NULL) != 0) {
-            fprintf(stderr, "flying-toasters: failed to load toaster sprite %d\n", i);
-            for (int j = 0; j < i; j++) {
-                XDestroyImage(toasterImg[j]);
-                XDestroyImage(toasterMaskImg[j]);
-            }
+    XImage *toasterImg[TOASTER_SPRITE_COUNT] = { NULL };
+    XImage *toasterMaskImg[TOASTER_SPRITE_COUNT] = { NULL };
+    XImage *toastImg = NULL, *toastMaskImg = NULL;
+    XImage *bufImg = NULL;
+    if (!pixmaps) {
+        if (load_sprite_images(dpy, toasterImg, toasterMaskImg, &toastImg, &toastMaskImg) != 0) {
             XFreeGC(dpy, gc);
             XCloseDisplay(dpy);
             return 1;
         }
-        toasterMaskImg[i] = clipMask;
-        clipMask = NULL;
-    }
-
-    XImage *toastImg = NULL;
-    if (XpmCreateImageFromData(dpy, toastXpm, &toastImg, &clipMask, NULL) != 0) {
-        fprintf(stderr, "flying-toasters: failed to load toast sprite\n");
-        for (int i = 0; i < TOASTER_SPRITE_COUNT; i++) {
-            XDestroyImage(toasterImg[i]);
-            XDestroyImage(toasterMaskImg[i]);
+        /* Screen buffer - XPutImage of the changed rects instead of one per sprite with clip masks */
+        bufImg = XCreateImage(dpy, vis, (unsigned)depth, ZPixmap, 0, NULL,
+            (unsigned)width, (unsigned)height, 32, 0);
+        if (bufImg) bufImg->data = (char *)calloc(1, (size_t)bufImg->bytes_per_line * height);
+        if (!bufImg || !bufImg->data) {
+            fprintf(stderr, "flying-toasters: XCreateImage failed\n");
+            if (bufImg) XDestroyImage(bufImg);
+            free_sprite_images(toasterImg, toasterMaskImg, toastImg, toastMaskImg);
+            XFreeGC(dpy, gc);
+            XCloseDisplay(dpy);
+            return 1;
         }
-        XFreeGC(dpy, gc);
-        XCloseDisplay(dpy);
-        return 1;
     }
-    XImage *toastMaskImg = clipMask;
 
-    /* Screen buffer - one XPutImage per frame instead of many with clip masks */
-    XImage *bufImg = XCreateImage(dpy, vis, (unsigned)depth, ZPixmap, 0, NULL,
-        (unsigned)width, (unsigned)height, 32, 0);
-    if (!bufImg) {
-        fprintf(stderr, "flying-toasters: XCreateImage failed\n");
-        for (int i = 0; i < TOASTER_SPRITE_COUNT; i++) {
-            XDestroyImage(toasterImg[i]);
-            XDestroyImage(toasterMaskImg[i]);
+    /* Fast path: composite 8-bit palette indices and expand them into bufImg
+     * when its pixels are native 16- or 32-bit TrueColor values. With
+     * FLYING_TOASTERS_X11_DIRECT=1 and 32-bit pixels, composite straight into
+     * bufImg instead, which is cheaper when most of the frame changes. */
+    const char *directEnv = getenv("FLYING_TOASTERS_X11_DIRECT");
+    int direct = !pixmaps && directEnv && *directEnv && strcmp(directEnv, "0") != 0 &&
+                 bufImg->bits_per_pixel == 32;
+    struct Compositor compositor;
+    struct Compositor *comp = NULL;
+    struct CompositorSprite *sprites = NULL;
+    uint8_t *indices = NULL;
+    struct Palette palette = { 0 };
+    uint32_t lut[PALETTE_SIZE];
+    {
+        if (!pixmaps && (bufImg->bits_per_pixel == 32 || bufImg->bits_per_pixel == 16) &&
+            bufImg->byte_order == host_byte_order() && vis->class == TrueColor) {
+            sprites = (struct CompositorSprite *)malloc(sizeof(*sprites) * (TOASTER_SPRITE_COUNT + 1));
+            if (!direct) indices = (uint8_t *)malloc((size_t)width * height);
         }
-        XDestroyImage(toastImg);
-        XDestroyImage(toastMaskImg);
-        XFreeGC(dpy, gc);
-        XCloseDisplay(dpy);
-        return 1;
-    }
-    bufImg->data = (char *)calloc(1, (size_t)bufImg->bytes_per_line * height);
-    if (!bufImg->data) {
-        XDestroyImage(bufImg);
-        for (int i = 0; i < TOASTER_SPRITE_COUNT; i++) {
-            XDestroyImage(toasterImg[i]);
-            XDestroyImage(toasterMaskImg[i]);
+        if (sprites && (direct || indices)) {
+            struct PixelFormat fmt = { (uint32_t)vis->red_mask, (uint32_t)vis->green_mask, (uint32_t)vis->blue_mask };
+            struct Palette *pal = direct ? NULL : &palette;
+            int ok = compositor_load_sprite(&sprites[TOAST_SPRITE], (const char *const *)toastXpm, &fmt, pal) == 0;
+            for (int i = 0; ok && i < TOASTER_SPRITE_COUNT; i++)
+                ok = compositor_load_sprite(&sprites[i], (const char *const *)toasterXpm[i], &fmt, pal) == 0;
+            if (ok && direct) {
+                if (compositor_init(&compositor, (uint32_t *)bufImg->data, width, height,
+                        bufImg->bytes_per_line / 4, (uint32_t)black, COMPOSE_FRONT_TO_BACK) == 0)
+                    comp = &compositor;
+            } else if (ok && compositor_init_indexed(&compositor, indices, width, height, width,
+                    0, COMPOSE_FRONT_TO_BACK) == 0) {
+                /* Palette entry 0 is the background, so it must be the screen's black. */
+                compositor_build_lut(&palette, &fmt, lut);
+                lut[0] = (uint32_t)black;
+                comp = &compositor;
+            }
+        }
+        if (!comp) {
+            free(sprites);
+            free(indices);
+            sprites = NULL;
+            indices = NULL;
         }
-        XDestroyImage(toastImg);
-        XDestroyImage(toastMaskImg);
-        XFreeGC(dpy, gc);
-        XCloseDisplay(dpy);
-        return 1;
     }
+    struct ComposeRect damage[MAX_DAMAGE_RECTS];
 
-    int *grid = initGrid();
-    struct Toaster toasters[TOASTER_COUNT];
-    struct Toast toasts[TOAST_COUNT];
+    /* Indexed frames are presented from a second thread, overlapping the next
+     * compose; without one, everything runs in sequence on this thread. */
+    struct X11Presenter presenter;
+    int pipelined = comp && comp->bytesPerPixel == 1 && start_presenter(&presenter, display_name, win, bufImg, lut, width, height) == 0;
 
-    for (int i = 0; i < TOASTER_COUNT; i++) {
-        toasters[i].slot = grid[i];
-        toasters[i].moveDistance = 1 + rand() % MAX_TOASTER_SPEED;
-        toasters[i].currentFrame = rand() % TOASTER_SPRITE_COUNT;
-        setToasterSpawn(&toasters[i], width, height);
-    }
-    for (int i = 0; i < TOAST_COUNT; i++) {
-        toasts[i].slot = grid[TOASTER_COUNT + i];
-        toasts[i].moveDistance = 1 + rand() % MAX_TOAST_SPEED;
-        setToastSpawn(&toasts[i], width, height);
-    }
+    struct Simulation sim;
+    initSimulation(&sim, width, height, TOASTER_COUNT, TOAST_COUNT, tickHz, seed);
+    const uint64_t frameBudget = 1000000000u / FPS;
 
-    int frame = 0;
-    while (1) {
-        for (int i = 0; i < TOAST_COUNT; i++) {
-            int nx = toasts[i].x - toasts[i].moveDistance;
-            int ny = toasts[i].y + toasts[i].moveDistance;
-            if (isScrolledOutOfScreen(nx, ny, height))
-                setToastSpawn(&toasts[i], width, height);
-            else { toasts[i].x = nx; toasts[i].y = ny; }
+    int mapped = !watching || xwa.map_state == IsViewable, obscured = 0, powered = 1;
+    uint64_t lastFrameStart = 0, lastDpmsCheck = 0;
+    int redraw = 0;
+    for (unsigned frame = 0; ; frame++) {
+        if (!handle_x11_events(dpy, &mapped, &obscured, &redraw)) break;
+        uint64_t frameStart = metrics_now_ns();
+        if (haveDpms && frameStart - lastDpmsCheck >= DPMS_POLL_MS * 1000000ull) {
+            powered = display_powered(dpy);
+            lastDpmsCheck = frameStart;
         }
+        if (!mapped || obscured || !powered) {
+            /* Nothing to see: sleep until an X event or the next DPMS poll.
+             * The simulation stays frozen, as nobody can tell. */
+            struct pollfd pfd = { ConnectionNumber(dpy), POLLIN, 0 };
+            poll(&pfd, 1, haveDpms ? DPMS_POLL_MS : -1);
+            lastFrameStart = 0;
+            redraw = 1;
+            continue;
+        }
+        advanceSimulation(&sim, lastFrameStart ? frameStart - lastFrameStart : sim.tickNs);
+        int alpha = simulationAlpha(&sim);
 
-        for (int i = 0; i < TOASTER_COUNT; i++) {
-            int nx = toasters[i].x - toasters[i].moveDistance;
-            int ny = toasters[i].y + toasters[i].moveDistance;
-            if (isScrolledOutOfScreen(nx, ny, height))
-                setToasterSpawn(&toasters[i], width, height);
-            else {
-                for (int j = 0; j < TOASTER_COUNT; j++) {
-                    if (i != j && hasSpriteCollision(toasters[j].x, toasters[j].y, nx, ny, 0)) {
-                        if (toasters[i].x <= toasters[j].x + SPRITE_SIZE) ny = toasters[i].y + toasters[j].moveDistance;
-                        else nx = toasters[i].x - toasters[j].moveDistance;
-                        break;
-                    }
-                }
-                toasters[i].x = nx; toasters[i].y = ny;
+        if (!watching && frame % FULL_REFRESH_FRAMES == 0) redraw = 1;
+        if (redraw) {
+            if (comp) comp->fullDamage = 1;
+            if (pixmaps) pixmaps->fullDamage = 1;
+            redraw = 0;
+        }
+        uint64_t composeEnd, presentNs;
+        if (pixmaps) {
+            draw_x11_pixmaps(dpy, win, pixmaps, &sim, alpha);
+            composeEnd = metrics_now_ns();
+            XFlush(dpy);
+            presentNs = metrics_now_ns() - composeEnd;
+        } else if (pipelined) {
+            /* Waits only if the present thread is a whole pipeline behind. */
+            int s = frame_queue_pop(&presenter.free);
+            struct X11Slot *slot = &presenter.slots[s];
+            compositor_set_target(comp, slot->indices);
+            slot->rects = draw_x11_composite(dpy, win, bufImg, toasterImg, toasterMaskImg, toastImg, toastMaskImg,
+                comp, sprites, &sim, alpha, width, height, black, slot->damage);
+            slot->view = *comp;
+            frame_queue_push(&presenter.ready, s);
+            composeEnd = metrics_now_ns();
+            presentNs = __atomic_load_n(&presenter.lastPresentNs, __ATOMIC_RELAXED);
+        } else {
+            int rects = draw_x11_composite(dpy, win, bufImg, toasterImg, toasterMaskImg, toastImg, toastMaskImg,
+                comp, sprites, &sim, alpha, width, height, black, damage);
+            if (comp && comp->bytesPerPixel == 1) expand_damage(comp, lut, bufImg, damage, rects);
+            composeEnd = metrics_now_ns();
+            put_damage(dpy, win, gc, bufImg, damage, rects);
+            presentNs = metrics_now_ns() - composeEnd;
+        }
+        if (lastFrameStart) {
+            int visibleToasters = 0, visibleToasts = 0, x, y;
+            for (int i = 0; i < TOASTER_COUNT; i++) {
+                toasterDrawPosition(&sim, i, alpha, &x, &y);
+                visibleToasters += isScrolledToScreen(x, y, width);
+            }
+            for (int i = 0; i < TOAST_COUNT; i++) {
+                toastDrawPosition(&sim, i, alpha, &x, &y);
+                visibleToasts += isScrolledToScreen(x, y, width);
             }
-            if (frame % (10 - toasters[i].moveDistance) == 0)
-                toasters[i].currentFrame = (toasters[i].currentFrame + 1) % TOASTER_SPRITE_COUNT;
+            metrics_record_frame(frameStart - lastFrameStart, frameBudget,
+                composeEnd - frameStart, presentNs, visibleToasters, visibleToasts);
         }
-        frame = (frame + 1) % 256;
+        lastFrameStart = frameStart;
 
-        draw_x11_composite(dpy, win, bufImg, toasterImg, toasterMaskImg, toastImg, toastMaskImg,
-            toasters, toasts, width, height, black);
-        XPutImage(dpy, win, gc, bufImg, 0, 0, 0, 0, width, height);
-        XFlush(dpy);
-
-        { struct timespec ts = { 0, (long)(1000000000 / FPS) }; nanosleep(&ts, NULL); }
+        uint64_t spent = metrics_now_ns() - frameStart;
+        if (spent < frameBudget) {
+            struct timespec ts = { 0, (long)(frameBudget - spent) };
+            nanosleep(&ts, NULL);
+        }
     }
 
-    free(bufImg->data);
-    XDestroyImage(bufImg);
-    for (int i = 0; i < TOASTER_SPRITE_COUNT; i++) {
-        XDestroyImage(toasterImg[i]);
-        XDestroyImage(toasterMaskImg[i]);
-    }
-    XDestroyImage(toastImg);
-    XDestroyImage(toastMaskImg);
+    if (pipelined) stop_presenter(&presenter);
+    if (pixmaps) free_pixmaps(pixmaps, dpy);
+    if (comp) compositor_free(comp);
+    free(sprites);
+    free(indices);
+    if (bufImg) XDestroyImage(bufImg);   /* frees its data too */
+    free_sprite_images(toasterImg, toasterMaskImg, toastImg, toastMaskImg);
     XFreeGC(dpy, gc);
     XCloseDisplay(dpy);
     return 0;
 }
+
+/* Offscreen stand-ins for the display-backed images: a 32bpp 0xRRGGBB buffer,
+ * and sprite/mask XImages decoded by libXpm rather than by the compositor.
+ * In pixmap mode buf plays the window and pixmaps.backImg the back buffer. */
+struct X11Offscreen {
+    int width, height;
+    XImage *buf;
+    struct X11Pixmaps pixmaps;
+    XImage *spriteImg[TOASTER_SPRITE_COUNT + 1];
+    XImage *maskImg[TOASTER_SPRITE_COUNT + 1];
+    struct Compositor compositor;
+    struct Compositor *comp;
+    struct CompositorSprite sprites[TOASTER_SPRITE_COUNT + 1];
+    uint8_t *indices;
+    uint32_t lut[PALETTE_SIZE];
+};
+
+static XImage *create_offscreen_image(int width, int height, int depth) {
+    XImage *img = (XImage *)calloc(1, sizeof(XImage));
+    if (!img) return NULL;
+    img->width = width;
+    img->height = height;
+    img->format = depth == 1 ? XYBitmap : ZPixmap;
+    img->byte_order = depth == 1 ? LSBFirst : host_byte_order();
+    img->bitmap_unit = 32;
+    img->bitmap_bit_order = LSBFirst;
+    img->bitmap_pad = 32;
+    img->depth = depth;
+    img->bits_per_pixel = depth == 1 ? 1 : 32;
+    img->bytes_per_line = depth == 1 ? (width + 31) / 32 * 4 : width * 4;
+    img->red_mask = 0xff0000;
+    img->green_mask = 0xff00;
+    img->blue_mask = 0xff;
+    img->data = (char *)calloc(1, (size_t)img->bytes_per_line * height);
+    if (!img->data || !XInitImage(img)) {
+        free(img->data);
+        free(img);
+        return NULL;
+    }
+    return img;
+}
+
+/* Fill sprite and mask from libXpm's parse of the data, the same parser that
+ * XpmCreateImageFromData runs. Without a display the colours cannot go
+ * through XParseColor/XAllocColor, so "#RRGGBB" specs are read here; only
+ * that lookup is not covered by -verify. */
+static int load_offscreen_sprite(char **xpm, XImage *sprite, XImage *mask) {
+    XpmImage image;
+    if (XpmCreateXpmImageFromData(xpm, &image, NULL) != XpmSuccess) return -1;
+    int ok = image.width == SPRITE_SIZE && image.height == SPRITE_SIZE;
+    for (int y = 0; ok && y < SPRITE_SIZE; y++) {
+        for (int x = 0; ok && x < SPRITE_SIZE; x++) {
+            const char *spec = image.colorTable[image.data[y * SPRITE_SIZE + x]].c_color;
+            int opaque = spec && strcasecmp(spec, "None") != 0;
+            if (opaque && (spec[0] != '#' || strlen(spec) != 7)) {
+                ok = 0;
+                break;
+            }
+            XPutPixel(sprite, x, y, opaque ? strtoul(spec + 1, NULL, 16) : 0);
+            XPutPixel(mask, x, y, (unsigned long)opaque);
+        }
+    }
+    XpmFreeXpmImage(&image);
+    return ok ? 0 : -1;
+}
+
+static void free_offscreen_image(XImage *img) {
+    if (!img) return;
+    free(img->data);
+    free(img);
+}
+
+struct X11Offscreen *x11_offscreen_open(int width, int height, enum X11RenderMode mode) {
+    static const struct PixelFormat rgb = { 0xff0000, 0xff00, 0xff };
+    struct Palette palette = { 0 };
+    struct X11Offscreen *o = (struct X11Offscreen *)calloc(1, sizeof(*o));
+    if (!o) return NULL;
+    o->width = width;
+    o->height = height;
+    int ok = (o->buf = create_offscreen_image(width, height, 24)) != NULL;
+    for (int i = 0; ok && i <= TOASTER_SPRITE_COUNT; i++) {
+        const char *const *xpm = i == TOAST_SPRITE ? (const char *const *)toastXpm
+                                                   : (const char *const *)toasterXpm[i];
+        ok = compositor_load_sprite(&o->sprites[i], xpm, &rgb, &palette) == 0 &&
+             (o->spriteImg[i] = create_offscreen_image(SPRITE_SIZE, SPRITE_SIZE, 24)) != NULL &&
+             (o->maskImg[i] = create_offscreen_image(SPRITE_SIZE, SPRITE_SIZE, 1)) != NULL &&
+             load_offscreen_sprite((char **)xpm, o->spriteImg[i], o->maskImg[i]) == 0;
+    }
+    if (ok && mode == X11_RENDER_DIRECT) {
+        ok = compositor_init(&o->compositor, (uint32_t *)o->buf->data, width, height, width,
+                             0, COMPOSE_FRONT_TO_BACK) == 0;
+        if (ok) o->comp = &o->compositor;
+    } else if (ok && mode == X11_RENDER_PIXMAP) {
+        struct X11Pixmaps *p = &o->pixmaps;
+        ok = (p->backImg = create_offscreen_image(width, height, 24)) != NULL;
+        p->windowImg = o->buf;
+        p->spriteImg = o->spriteImg;
+        p->maskImg = o->maskImg;
+        p->width = width;
+        p->height = height;
+        p->fullDamage = 1;
+    } else if (ok && mode == X11_RENDER_INDEXED) {
+        ok = (o->indices = (uint8_t *)malloc((size_t)width * height)) != NULL &&
+             compositor_init_indexed(&o->compositor, o->indices, width, height, width,
+                                     0, COMPOSE_FRONT_TO_BACK) == 0;
+        if (ok) {
+            compositor_build_lut(&palette, &rgb, o->lut);
+            o->comp = &o->compositor;
+        }
+    }
+    if (!ok) {
+        x11_offscreen_close(o);
+        return NULL;
+    }
+    return o;
+}
+
+const uint32_t *x11_offscreen_render(struct X11Offscreen *o, const struct Simulation *sim, int alpha) {
+    if (o->pixmaps.backImg) {
+        draw_x11_pixmaps(NULL, 0, &o->pixmaps, sim, alpha);
+        return (const uint32_t *)o->buf->data;
+    }
+    struct ComposeRect damage[MAX_DAMAGE_RECTS];
+    int rects = draw_x11_composite(NULL, 0, o->buf, o->spriteImg, o->maskImg,
+        o->spriteImg[TOAST_SPRITE], o->maskImg[TOAST_SPRITE],
+        o->comp, o->sprites, sim, alpha, o->width, o->height, 0, damage);
+    if (o->comp && o->comp->bytesPerPixel == 1) expand_damage(o->comp, o->lut, o->buf, damage, rects);
+    return (const uint32_t *)o->buf->data;
+}
+
+void x11_offscreen_close(struct X11Offscreen *o) {
+    if (!o) return;
+    if (o->comp) compositor_free(o->comp);
+    free(o->indices);
+    free_offscreen_image(o->buf);
+    free_offscreen_image(o->pixmaps.backImg);
+    for (int i = 0; i <= TOASTER_SPRITE_COUNT; i++) {
+        free_offscreen_image(o->spriteImg[i]);
+        free_offscreen_image(o->maskImg[i]);
+    }
+    free(o);
+}
@@ -0,0 +1,25 @@
+#ifndef XSCREENSAVER_X11_H
+#define XSCREENSAVER_X11_H
+
+#include <stdint.h>
+#include "simulation.h"
+
+/* Draw on XSCREENSAVER_WINDOW until killed. */
+int run_xscreensaver_x11(int tickHz, uint32_t seed);
+
+enum X11RenderMode {
+    X11_RENDER_DIRECT,      /* compositor writing 32-bit pixels straight into the image */
+    X11_RENDER_INDEXED,     /* 8-bit palette frame, damage rects expanded into the image */
+    X11_RENDER_LEGACY,      /* XGetPixel/XPutPixel fallback for other visuals */
+    X11_RENDER_PIXMAP       /* server-side pixmaps for remote displays */
+};
+
+/* Offscreen rendering through draw_x11_composite() or draw_x11_pixmaps()
+ * without a display, so -verify can compare the X11 paths with the SDL ones.
+ * Rendered pixels are 0x00RRGGBB, width pixels per row. */
+struct X11Offscreen;
+struct X11Offscreen *x11_offscreen_open(int width, int height, enum X11RenderMode mode);
+const uint32_t *x11_offscreen_render(struct X11Offscreen *o, const struct Simulation *sim, int alpha);
+void x11_offscreen_close(struct X11Offscreen *o);
+
+#endif
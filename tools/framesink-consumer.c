@@ -0,0 +1,155 @@
+/*
+ * Reference consumer for the -framesink output: maps the shared frame ring,
+ * waits on the eventfd and reads each published frame in place.
+ * Prints the frame rate, skipped and torn frames, and a hash of the latest
+ * frame once per second.
+ *
+ *   framesink-consumer SOCKET [FRAMES]
+ */
+#define _GNU_SOURCE
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "../src/framesink.h"
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Receive the memfd and eventfd sent on connect. */
+static int receive_fds(int sock, int *memfd, int *eventFd) {
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS ||
+        cm->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+        return -1;
+    int fds[2];
+    memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    *memfd = fds[0];
+    *eventFd = fds[1];
+    return 0;
+}
+
+/* FNV-1a over the RGB bytes, reading the shared pixels directly. */
+static uint64_t hash_frame(const uint8_t *pixels, const struct FrameSinkHeader *hdr) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (uint32_t y = 0; y < hdr->height; y++) {
+        const uint32_t *row = (const uint32_t *)(pixels + (size_t)y * hdr->stride);
+        for (uint32_t x = 0; x < hdr->width; x++) {
+            for (int b = 0; b < 3; b++) {
+                h ^= (row[x] >> (8 * b)) & 0xff;
+                h *= 0x100000001b3ULL;
+            }
+        }
+    }
+    return h;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s SOCKET [FRAMES]\n", argv[0]);
+        return 2;
+    }
+    long limit = argc > 2 ? atol(argv[2]) : 0;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, argv[1]);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int memfd, eventFd;
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        receive_fds(sock, &memfd, &eventFd) < 0) {
+        perror("framesink-consumer: connect");
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(memfd, &st) < 0 || (size_t)st.st_size < sizeof(struct FrameSinkHeader)) {
+        fprintf(stderr, "framesink-consumer: bad memfd\n");
+        return 1;
+    }
+    const uint8_t *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, memfd, 0);
+    if (base == MAP_FAILED) {
+        perror("framesink-consumer: mmap");
+        return 1;
+    }
+    const struct FrameSinkHeader *hdr = (const struct FrameSinkHeader *)base;
+    if (hdr->magic != FRAMESINK_MAGIC || hdr->version != FRAMESINK_VERSION ||
+        hdr->format != FRAMESINK_FORMAT_XRGB8888 ||
+        hdr->slotOffset + (uint64_t)hdr->slotCount * hdr->slotSize > (uint64_t)st.st_size) {
+        fprintf(stderr, "framesink-consumer: unsupported frame sink\n");
+        return 1;
+    }
+    printf("connected: %ux%u, %u slots\n", hdr->width, hdr->height, hdr->slotCount);
+
+    uint64_t lastSeq = 0, frames = 0, skipped = 0, torn = 0, hash = 0;
+    uint64_t reportStart = now_ns(), reportFrames = 0;
+    struct pollfd fds[2] = { { eventFd, POLLIN, 0 }, { sock, POLLIN, 0 } };
+    while (!limit || (long)frames < limit) {
+        if (poll(fds, 2, 2000) <= 0) {
+            fprintf(stderr, "framesink-consumer: no frames for 2s\n");
+            continue;
+        }
+        if (fds[1].revents) break;   /* the saver exited */
+        uint64_t count;
+        if (read(eventFd, &count, sizeof(count)) != sizeof(count)) continue;
+
+        uint64_t seq = __atomic_load_n(&hdr->latestSequence, __ATOMIC_ACQUIRE);
+        if (seq == lastSeq) continue;
+        const struct FrameSinkSlot *slot = &hdr->slots[seq % hdr->slotCount];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != seq) {
+            torn++;
+            continue;
+        }
+        uint64_t h = hash_frame(base + hdr->slotOffset + (seq % hdr->slotCount) * hdr->slotSize, hdr);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != seq) {
+            torn++;
+            continue;
+        }
+        if (lastSeq && seq > lastSeq + 1) skipped += seq - lastSeq - 1;
+        lastSeq = seq;
+        hash = h;
+        frames++;
+        reportFrames++;
+
+        uint64_t t = now_ns();
+        if (t - reportStart >= 1000000000u) {
+            printf("seq %llu: %.1f fps, %llu skipped, %llu torn, hash %016llx\n",
+                   (unsigned long long)seq, reportFrames * 1e9 / (double)(t - reportStart),
+                   (unsigned long long)skipped, (unsigned long long)torn, (unsigned long long)hash);
+            fflush(stdout);
+            reportStart = t;
+            reportFrames = 0;
+        }
+    }
+    printf("%llu frames, %llu skipped, %llu torn\n", (unsigned long long)frames,
+           (unsigned long long)skipped, (unsigned long long)torn);
+    return 0;
+}